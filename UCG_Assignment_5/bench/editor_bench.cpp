@@ -0,0 +1,296 @@
+// Throughput of the editing operations of assignment5, without a window.
+//
+// Usage: editor_bench [--sizes 1000,10000,...] [--queries Q] [--csv] [--output path]
+//
+// For every soup size (1k to 10M triangles by default), drives the triangle
+// store and the spatial indices the way the editor does and reports:
+//
+//   insert_tri_per_s     triangles appended one by one, grids kept up to date
+//   pick_us              latency of a point pick (mean and p99)
+//   nearest_us           latency of a nearest-vertex query (mean and p99)
+//   cull_us              latency of the visibility pass for a view of 1/16 of
+//                        the scene, whose triangles are in random order
+//   drawn_fraction       fraction of the triangles that view still draws
+//   rotate_tri_per_s     bulk rotation of every triangle (H/J)
+//   scale_tri_per_s      bulk scaling of every triangle (K/L)
+//   bulk_edit_ms         rotation of every triangle followed by the rebuild
+//                        of the grids, as the editor does it
+//   delete_us            order-preserving erase of a triangle from the store
+//                        and grids
+//   *_bytes              bytes uploaded to the GPU by one edit of that kind
+//
+// Results are written as JSON (or CSV with --csv) to the standard output or
+// to the given file, so that runs of different versions can be compared.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "spatial_index.h"
+#include "transform.h"
+#include "thread_pool.h"
+#include "dirty_ranges.h"
+#include "simd.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The four vertex streams of the editor, only their dirty ranges are tracked:
+// a flush sends every column covered by them, as VertexBufferObject::flush
+struct Uploads {
+	DirtyRanges positions, colors, states, transforms;
+
+	// Every stream of triangles [begin, end)
+	void triangles(int begin, int end) {
+		positions.add(begin * 3, end * 3);
+		colors.add(begin * 3, end * 3);
+		states.add(begin * 3, end * 3);
+		transforms.add(begin, end);
+	}
+
+	// Bytes sent by a flush, the ranges are cleared
+	size_t flush() {
+		size_t bytes = sizeof(float) * (positions.columns() * 3 + colors.columns() * 3 + states.columns() +
+			transforms.columns() * 6);
+		positions.clear();
+		colors.clear();
+		states.clear();
+		transforms.clear();
+		return bytes;
+	}
+};
+
+struct Result {
+	int triangles;
+	double insert_tri_per_s;
+	size_t insert_bytes;
+	double pick_us[2];
+	double nearest_us[2];
+	double cull_us;
+	double drawn_fraction;
+	double rotate_tri_per_s;
+	double scale_tri_per_s;
+	double bulk_edit_ms;
+	size_t bulk_bytes;
+	double delete_us;
+	size_t delete_bytes;
+};
+
+// Mean and 99th percentile of the latencies, in microseconds
+void latency(std::vector<double> &seconds, double out[2]) {
+	double sum = 0;
+	for (size_t i = 0; i < seconds.size(); ++i) {
+		sum += seconds[i];
+	}
+	std::sort(seconds.begin(), seconds.end());
+	out[0] = sum / seconds.size() * 1e6;
+	out[1] = seconds[std::min(seconds.size() - 1, seconds.size() * 99 / 100)] * 1e6;
+}
+
+Result run(int n, int queries, ThreadPool &pool) {
+	Result r;
+	r.triangles = n;
+	std::mt19937 rng(42);
+	// Triangles shrink as the soup grows, so that the overlap stays the same
+	std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+	float extent = 4.0f / std::sqrt((float) n);
+	std::uniform_real_distribution<float> offset(-extent, extent);
+
+	TriangleStore store;
+	TriangleGrid grid;
+	VertexGrid vertex_grid;
+	Uploads uploads;
+
+	// Insertion, the grids are rebuilt when they double (like an import), so
+	// that their cells fit the triangles
+	Clock::time_point start = Clock::now();
+	for (int t = 0; t < n; ++t) {
+		Eigen::Vector2f c(position(rng), position(rng));
+		store.append(c + Eigen::Vector2f(offset(rng), offset(rng)), c + Eigen::Vector2f(offset(rng), offset(rng)),
+			c + Eigen::Vector2f(offset(rng), offset(rng)), Eigen::Vector3f(1, 0, 0));
+		if (t >= 1024 && (t & (t - 1)) == 0) {
+			grid.build(store, t + 1);
+			vertex_grid.build(store, t + 1);
+		} else {
+			grid.append(store);
+			vertex_grid.append(store);
+		}
+	}
+	r.insert_tri_per_s = n / seconds_since(start);
+	uploads.triangles(n - 1, n);
+	r.insert_bytes = uploads.flush();
+
+	std::vector<double> times(queries);
+	long long checksum = 0;
+	for (int i = 0; i < queries; ++i) {
+		float x = position(rng), y = position(rng);
+		start = Clock::now();
+		checksum += grid.pick(store, x, y);
+		times[i] = seconds_since(start);
+	}
+	latency(times, r.pick_us);
+	for (int i = 0; i < queries; ++i) {
+		float x = position(rng), y = position(rng);
+		start = Clock::now();
+		checksum += vertex_grid.nearest(store, x, y, 0.1f);
+		times[i] = seconds_since(start);
+	}
+	latency(times, r.nearest_us);
+
+	// Views of a quarter of the width and height of the scene, anywhere in it
+	std::uniform_real_distribution<float> corner(-1.0f, 0.5f);
+	std::vector<unsigned int> visible;
+	int views = std::max(1, std::min(queries, 100));
+	size_t drawn = 0;
+	start = Clock::now();
+	for (int i = 0; i < views; ++i) {
+		float x = corner(rng), y = corner(rng);
+		grid.visible(x, y, x + 0.5f, y + 0.5f, visible);
+		drawn += visible.size() / 3;
+	}
+	r.cull_us = seconds_since(start) / views * 1e6;
+	r.drawn_fraction = (double) drawn / views / n;
+
+	// Bulk transforms, the second one moves the triangles back into place
+	start = Clock::now();
+	transform_triangles(store, 0, n, TriangleTransform::rotation(0.1f), &pool);
+	transform_triangles(store, 0, n, TriangleTransform::rotation(-0.1f), &pool);
+	r.rotate_tri_per_s = 2.0 * n / seconds_since(start);
+	start = Clock::now();
+	transform_triangles(store, 0, n, TriangleTransform::scaling(1.25f), &pool);
+	transform_triangles(store, 0, n, TriangleTransform::scaling(0.8f), &pool);
+	r.scale_tri_per_s = 2.0 * n / seconds_since(start);
+
+	start = Clock::now();
+	transform_triangles(store, 0, n, TriangleTransform::rotation(0.1f), &pool);
+	uploads.transforms.add(0, n);
+	grid.build(store, n);
+	vertex_grid.build(store, n);
+	r.bulk_edit_ms = seconds_since(start) * 1e3;
+	r.bulk_bytes = uploads.flush();
+
+	// Deletion of random triangles, the later ones move down to keep the order
+	// (O(n) each, so fewer of them on large scenes)
+	int deletes = std::max(1, std::min(n / 2, 10000000 / n));
+	std::uniform_int_distribution<int> triangle(0, n - deletes - 1);
+	size_t bytes = 0;
+	start = Clock::now();
+	for (int i = 0; i < deletes; ++i) {
+		int t = triangle(rng);
+		store.erase(t);
+		grid.erase(t);
+		vertex_grid.erase(t);
+		uploads.triangles(t, store.size());
+		bytes += uploads.flush();
+	}
+	r.delete_us = seconds_since(start) / deletes * 1e6;
+	r.delete_bytes = bytes / deletes;
+
+	// Keep the queries from being optimized away
+	if (checksum == 42) {
+		std::fprintf(stderr, " ");
+	}
+	return r;
+}
+
+void write_json(FILE *out, const std::vector<Result> &results, int threads) {
+	std::fprintf(out, "{\n  \"kernel\": \"%s\",\n  \"threads\": %d,\n  \"results\": [", simd_name(transform_kernel()),
+		threads);
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result &r = results[i];
+		std::fprintf(out, "%s\n    {\"triangles\": %d, \"insert_tri_per_s\": %.4g, \"insert_bytes\": %zu, "
+			"\"pick_us_mean\": %.4g, \"pick_us_p99\": %.4g, \"nearest_us_mean\": %.4g, \"nearest_us_p99\": %.4g, "
+			"\"cull_us\": %.4g, \"drawn_fraction\": %.4g, \"rotate_tri_per_s\": %.4g, \"scale_tri_per_s\": %.4g, "
+			"\"bulk_edit_ms\": %.4g, \"bulk_bytes\": %zu, \"delete_us\": %.4g, \"delete_bytes\": %zu}",
+			i ? "," : "", r.triangles, r.insert_tri_per_s, r.insert_bytes, r.pick_us[0], r.pick_us[1],
+			r.nearest_us[0], r.nearest_us[1], r.cull_us, r.drawn_fraction, r.rotate_tri_per_s, r.scale_tri_per_s,
+			r.bulk_edit_ms, r.bulk_bytes, r.delete_us, r.delete_bytes);
+	}
+	std::fprintf(out, "\n  ]\n}\n");
+}
+
+void write_csv(FILE *out, const std::vector<Result> &results) {
+	std::fprintf(out, "triangles,insert_tri_per_s,insert_bytes,pick_us_mean,pick_us_p99,nearest_us_mean,"
+		"nearest_us_p99,cull_us,drawn_fraction,rotate_tri_per_s,scale_tri_per_s,bulk_edit_ms,bulk_bytes,delete_us,"
+		"delete_bytes\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result &r = results[i];
+		std::fprintf(out, "%d,%.4g,%zu,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g,%zu,%.4g,%zu\n", r.triangles,
+			r.insert_tri_per_s, r.insert_bytes, r.pick_us[0], r.pick_us[1], r.nearest_us[0], r.nearest_us[1],
+			r.cull_us, r.drawn_fraction, r.rotate_tri_per_s, r.scale_tri_per_s, r.bulk_edit_ms, r.bulk_bytes, r.delete_us,
+			r.delete_bytes);
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+	std::vector<int> sizes;
+	int queries = 10000;
+	bool csv = false;
+	std::string output;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--sizes" && has_value) {
+			for (const char *p = argv[++i]; *p; ) {
+				sizes.push_back(std::atoi(p));
+				p += std::strcspn(p, ",");
+				p += *p == ',';
+			}
+		} else if (arg == "--queries" && has_value) {
+			queries = std::atoi(argv[++i]);
+		} else if (arg == "--csv") {
+			csv = true;
+		} else if (arg == "--output" && has_value) {
+			output = argv[++i];
+		} else {
+			std::fprintf(stderr, "Usage: editor_bench [--sizes 1000,10000,...] [--queries Q] [--csv] [--output path]\n");
+			return 2;
+		}
+	}
+	if (sizes.empty()) {
+		const int defaults[] = { 1000, 10000, 100000, 1000000, 10000000 };
+		sizes.assign(defaults, defaults + 5);
+	}
+	if (queries < 1 || std::count_if(sizes.begin(), sizes.end(), [](int n) { return n < 2; }) > 0) {
+		std::fprintf(stderr, "editor_bench: sizes must be at least 2 and queries at least 1\n");
+		return 2;
+	}
+
+	ThreadPool pool;
+	std::vector<Result> results;
+	for (size_t i = 0; i < sizes.size(); ++i) {
+		std::fprintf(stderr, "%d triangles...\n", sizes[i]);
+		results.push_back(run(sizes[i], queries, pool));
+	}
+
+	FILE *out = output.empty() ? stdout : std::fopen(output.c_str(), "w");
+	if (!out) {
+		std::fprintf(stderr, "%s: cannot write the results\n", output.c_str());
+		return 1;
+	}
+	if (csv) {
+		write_csv(out, results);
+	} else {
+		write_json(out, results, pool.size());
+	}
+	if (out != stdout && std::fclose(out) != 0) {
+		std::fprintf(stderr, "%s: cannot write the results\n", output.c_str());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,91 @@
+// Microbenchmark of the point-in-triangle kernels.
+//
+// Usage: hit_test_bench [triangles] [points]
+//
+// For every kernel supported by the CPU, reports the number of triangles tested
+// per second when scanning the whole soup (no hit, so every block is tested)
+// and when testing short candidate lists like the ones of a grid cell.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "hit_test.h"
+#include "triangle_store.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+	int n = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	int points = argc > 2 ? std::atoi(argv[2]) : 200;
+	const int candidates_per_list = 64;
+
+	// Small triangles scattered over [-1, 1]^2, queries are made outside of it
+	// for the full scans so that no block stops the scan early
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> offset(-0.05f, 0.05f);
+	TriangleStore store;
+	store.reserve(n);
+	for (int t = 0; t < n; ++t) {
+		Eigen::Vector2f c(position(rng), position(rng));
+		store.append(c + Eigen::Vector2f(offset(rng), offset(rng)), c + Eigen::Vector2f(offset(rng), offset(rng)),
+			c + Eigen::Vector2f(offset(rng), offset(rng)), Eigen::Vector3f::Zero());
+	}
+
+	std::uniform_int_distribution<int> triangle(0, n - 1);
+	std::vector<int> lists(points * candidates_per_list);
+	for (size_t i = 0; i < lists.size(); ++i) {
+		lists[i] = triangle(rng);
+	}
+	std::vector<Eigen::Vector2f> queries(points);
+	for (int i = 0; i < points; ++i) {
+		queries[i] = Eigen::Vector2f(position(rng), position(rng));
+	}
+
+	std::printf("%d triangles, %d points\n", n, points);
+	std::printf("%-8s %16s %16s\n", "kernel", "scan (tri/s)", "lists (tri/s)");
+
+	const SimdLevel kernels[] = { SimdScalar, SimdSSE2, SimdAVX2 };
+	for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+		if (!set_hit_test_kernel(kernels[k])) {
+			continue;
+		}
+
+		// Sum the results so that the calls cannot be optimized away
+		long long checksum = 0;
+
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < points; ++i) {
+			checksum += hit_test_topmost(store, n, 2.0f + queries[i][0], 2.0f + queries[i][1]);
+		}
+		double scan = (double) n * points / seconds_since(start);
+
+		// Repeat the lists so that both measures run for a similar time
+		int rounds = std::max(1, n / candidates_per_list);
+		start = Clock::now();
+		for (int r = 0; r < rounds; ++r) {
+			for (int i = 0; i < points; ++i) {
+				checksum += hit_test_topmost(store, &lists[i * candidates_per_list], candidates_per_list,
+					queries[i][0], queries[i][1]);
+			}
+		}
+		double list = (double) rounds * points * candidates_per_list / seconds_since(start);
+
+		std::printf("%-8s %16.3e %16.3e   (checksum %lld)\n", simd_name(kernels[k]), scan, list, checksum);
+	}
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "bake.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const float quantization_steps = 65535.0f;
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+int KeyframeBake::update(KeyframeStore &keys, ThreadPool *pool) {
+	const int n = keys.size() * channels;
+	std::vector<Track> baked(n);
+	std::vector<char> kept(n, 0);
+	std::vector<int> stale;
+	int sizes[channels] = { 0, 0, 0 };
+	bool moved = n != (int) tracks.size();
+
+	// Lay the tracks out again: the samples of the unchanged ones are kept, the
+	// others get the number of samples their keys need now. Stale tracks that
+	// keep their size are baked in place.
+	for (int i = 0; i < n; ++i) {
+		int o = i / channels;
+		KeyframeStore::Channel c = (KeyframeStore::Channel) (i % channels);
+		Track &tr = baked[i];
+		if (i < (int) tracks.size() && tracks[i].revision == keys.revision(o, c)) {
+			tr = tracks[i];
+			kept[i] = 1;
+		} else {
+			int count = keys.keys(o, c);
+			float start = count > 0 ? keys.key_time(o, c, 0) : 0.0f;
+			float length = count > 1 ? keys.key_time(o, c, count - 1) - start : 0.0f;
+			tr.start = start;
+			tr.count = length > 0 ? std::max(2, (int) std::ceil(length * rate) + 1) : 1;
+			tr.frequency = length > 0 ? (tr.count - 1) / length : 0.0f;
+			tr.revision = keys.revision(o, c);
+			stale.push_back(i);
+		}
+		int w = KeyframeStore::width(c);
+		tr.first = sizes[c];
+		sizes[c] += tr.count * w;
+		moved = moved || tr.first != tracks[i].first || tr.count != tracks[i].count;
+	}
+	if (stale.empty() && !moved) {
+		return 0;
+	}
+
+	if (moved) {
+		std::vector<unsigned short> packed[channels];
+		for (int c = 0; c < channels; ++c) {
+			packed[c].resize(sizes[c]);
+		}
+		for (int i = 0; i < n; ++i) {
+			if (kept[i]) {
+				const Track &tr = baked[i];
+				int c = i % channels, w = KeyframeStore::width((KeyframeStore::Channel) c);
+				std::memcpy(&packed[c][tr.first], &samples[c][tracks[i].first], tr.count * w * sizeof(unsigned short));
+			}
+		}
+		for (int c = 0; c < channels; ++c) {
+			samples[c].swap(packed[c]);
+		}
+	}
+	tracks.swap(baked);
+
+	// Tracks touch disjoint samples and keys, so they bake in parallel
+	std::function<void(int, int)> run = [&](int begin, int end) {
+		for (int j = begin; j < end; ++j) {
+			int i = stale[j];
+			bake(keys, i / channels, (KeyframeStore::Channel) (i % channels), tracks[i]);
+		}
+	};
+	if (pool) {
+		pool->parallel_for((int) stale.size(), 64, run);
+	} else {
+		run(0, (int) stale.size());
+	}
+	return (int) stale.size();
+}
+
+void KeyframeBake::bake(KeyframeStore &keys, int o, KeyframeStore::Channel c, Track &tr) {
+	int w = KeyframeStore::width(c);
+	std::vector<float> values(tr.count * w);
+	float dt = tr.count > 1 ? 1 / tr.frequency : 0.0f;
+	keys.sample(o, c, tr.start, dt, tr.count, values.data());
+
+	unsigned short *q = &samples[c][tr.first];
+	for (int d = 0; d < w; ++d) {
+		float lo = values[d], hi = values[d];
+		for (int s = 1; s < tr.count; ++s) {
+			lo = std::min(lo, values[s * w + d]);
+			hi = std::max(hi, values[s * w + d]);
+		}
+		tr.base[d] = lo;
+		tr.step[d] = (hi - lo) / quantization_steps;
+		float scale = hi > lo ? quantization_steps / (hi - lo) : 0.0f;
+		for (int s = 0; s < tr.count; ++s) {
+			q[s * w + d] = (unsigned short) std::min(quantization_steps, (values[s * w + d] - lo) * scale + 0.5f);
+		}
+	}
+}
+
+void KeyframeBake::lookup(const Track &tr, KeyframeStore::Channel c, float time, float *out) const {
+	int w = KeyframeStore::width(c);
+	const unsigned short *q = &samples[c][tr.first];
+	float f = std::min(std::max((time - tr.start) * tr.frequency, 0.0f), (float) (tr.count - 1));
+	int i = std::min((int) f, std::max(tr.count - 2, 0));
+	float u = f - i;
+	const unsigned short *a = q + i * w, *b = q + std::min(i + 1, tr.count - 1) * w;
+	for (int d = 0; d < w; ++d) {
+		float qa = a[d], qb = b[d];
+		out[d] = tr.base[d] + (qa + (qb - qa) * u) * tr.step[d];
+	}
+}
+
+void KeyframeBake::evaluate(const KeyframeStore &keys, float time, std::vector<Affine> &poses,
+	ThreadPool *pool) const
+{
+	int n = (int) tracks.size() / channels;
+	poses.resize(n);
+	std::function<void(int, int)> run = [&](int begin, int end) {
+		for (int o = begin; o < end; ++o) {
+			float position[2], angle, scale;
+			lookup(tracks[o * channels + KeyframeStore::Position], KeyframeStore::Position, time, position);
+			lookup(tracks[o * channels + KeyframeStore::Rotation], KeyframeStore::Rotation, time, &angle);
+			lookup(tracks[o * channels + KeyframeStore::Scale], KeyframeStore::Scale, time, &scale);
+			poses[o] = keys.pose(o, Eigen::Vector2f(position[0], position[1]), angle, scale);
+		}
+	};
+	if (pool) {
+		pool->parallel_for(n, 1024, run);
+	} else {
+		run(0, n);
+	}
+}
+
+size_t KeyframeBake::bytes() const {
+	size_t total = tracks.size() * sizeof(Track);
+	for (int c = 0; c < channels; ++c) {
+		total += samples[c].size() * sizeof(unsigned short);
+	}
+	return total;
+}
+
+void KeyframeBake::clear() {
+	tracks.clear();
+	for (int c = 0; c < channels; ++c) {
+		samples[c].clear();
+	}
+}
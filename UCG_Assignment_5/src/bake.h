@@ -0,0 +1,72 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "keyframes.h"
+#include "thread_pool.h"
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Keyframe tracks sampled at a fixed rate and quantized to 16 bits.
+//
+// Every track of a KeyframeStore is sampled uniformly from its first to its
+// last key, and every float of a sample is stored as an unsigned 16-bit offset
+// from the minimum of the track in steps of (maximum - minimum) / 65535.
+// Playback finds the two samples around a time directly and interpolates them
+// linearly, instead of searching the keys and evaluating the curves.
+//
+// A track is baked again only when its revision in the store changes, so
+// editing a few keys of a large scene costs a few tracks.
+class KeyframeBake {
+public:
+	KeyframeBake() : rate(60) { }
+
+	typedef KeyframeStore::Affine Affine;
+
+	// Samples per second of the tracks baked from now on
+	float sample_rate() const { return rate; }
+	void set_sample_rate(float samples_per_second) { rate = samples_per_second; }
+
+	// Bake the tracks of keys edited since the previous update, returns the
+	// number of tracks baked
+	int update(KeyframeStore &keys, ThreadPool *pool = 0);
+
+	// Same as KeyframeStore::evaluate from the samples, keys must be the store
+	// of the last update
+	void evaluate(const KeyframeStore &keys, float time, std::vector<Affine> &poses, ThreadPool *pool = 0) const;
+
+	// Memory used by the samples, in bytes
+	size_t bytes() const;
+
+	void clear();
+
+private:
+	static const int channels = KeyframeStore::channels;
+
+	struct Track {
+		// Time of the first sample and samples per second of the track
+		float start;
+		float frequency;
+		// Range of samples in the array of its channel
+		int first;
+		int count;
+		// Value of offset 0 and of one step, per float of a sample
+		float base[2];
+		float step[2];
+		// Revision of the keys this was baked from
+		unsigned int revision;
+	};
+
+	float rate;
+
+	// channels tracks per object
+	std::vector<Track> tracks;
+
+	// Samples of every channel, track after track, KeyframeStore::width() values each
+	std::vector<unsigned short> samples[channels];
+
+	// Sample a track of keys and quantize it into the samples at tr.first
+	void bake(KeyframeStore &keys, int o, KeyframeStore::Channel c, Track &tr);
+
+	// Value of a track at the given time, width() floats written to out
+	void lookup(const Track &tr, KeyframeStore::Channel c, float time, float *out) const;
+};
@@ -0,0 +1,118 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "camera.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+////////////////////////////////////////////////////////////////////////////////
+
+Camera2D::Camera2D()
+	: look_at(Eigen::Vector2f::Zero())
+	, scale(1)
+	, ratio(1)
+	, viewport(1, 1)
+{
+	update();
+}
+
+void Camera2D::set_center(const Eigen::Vector2f &center) {
+	look_at = center;
+	update();
+}
+
+void Camera2D::set_zoom(float zoom) {
+	assert(zoom > 0);
+	scale = zoom;
+	update();
+}
+
+void Camera2D::set_aspect(float aspect) {
+	assert(aspect > 0);
+	ratio = aspect;
+	update();
+}
+
+void Camera2D::pan(const Eigen::Vector2f &offset) {
+	look_at -= backward.topLeftCorner<2, 2>().diagonal().cwiseProduct(offset);
+	update();
+}
+
+void Camera2D::zoom_by(float factor) {
+	set_zoom(scale * factor);
+}
+
+void Camera2D::set_view(const Eigen::Matrix3f &view) {
+	float sx = view(0, 0), sy = view(1, 1);
+	if (!(std::abs(sx) > 1e-20f && std::abs(sy) > 1e-20f)) {
+		return;
+	}
+	scale = std::abs(sy);
+	ratio = std::abs(sy / sx);
+	look_at = Eigen::Vector2f(-view(0, 2) / sx, -view(1, 2) / sy);
+	update();
+}
+
+void Camera2D::set_viewport(int width, int height) {
+	Eigen::Vector2f size((float) std::max(width, 1), (float) std::max(height, 1));
+	if (size != viewport) {
+		viewport = size;
+		update();
+	}
+}
+
+Eigen::Vector2f Camera2D::world_to_ndc(const Eigen::Vector2f &p) const {
+	return forward.topLeftCorner<2, 2>().diagonal().cwiseProduct(p) + forward.topRightCorner<2, 1>();
+}
+
+Eigen::Vector2f Camera2D::ndc_to_world(const Eigen::Vector2f &p) const {
+	return backward.topLeftCorner<2, 2>().diagonal().cwiseProduct(p) + backward.topRightCorner<2, 1>();
+}
+
+Eigen::Vector2f Camera2D::screen_to_world(const Eigen::Vector2f &pixel) const {
+	return screen_gain.cwiseProduct(pixel) + screen_offset;
+}
+
+Eigen::Vector2f Camera2D::world_to_screen(const Eigen::Vector2f &p) const {
+	return (p - screen_offset).cwiseQuotient(screen_gain);
+}
+
+void Camera2D::screen_to_world(const float *in, float *out, int n) const {
+	// Independent multiply-adds over the pairs, the compiler vectorizes them
+	const float gx = screen_gain[0], gy = screen_gain[1];
+	const float ox = screen_offset[0], oy = screen_offset[1];
+	for (int i = 0; i < n; ++i) {
+		out[i * 2] = in[i * 2] * gx + ox;
+		out[i * 2 + 1] = in[i * 2 + 1] * gy + oy;
+	}
+}
+
+void Camera2D::world_to_screen(const float *in, float *out, int n) const {
+	const float gx = 1 / screen_gain[0], gy = 1 / screen_gain[1];
+	const float ox = -screen_offset[0] * gx, oy = -screen_offset[1] * gy;
+	for (int i = 0; i < n; ++i) {
+		out[i * 2] = in[i * 2] * gx + ox;
+		out[i * 2 + 1] = in[i * 2 + 1] * gy + oy;
+	}
+}
+
+void Camera2D::screen_rect_to_world(const Eigen::Vector2f &a, const Eigen::Vector2f &b,
+	Eigen::Vector2f &min, Eigen::Vector2f &max) const
+{
+	Eigen::Vector2f p = screen_to_world(a), q = screen_to_world(b);
+	min = p.cwiseMin(q);
+	max = p.cwiseMax(q);
+}
+
+void Camera2D::update() {
+	const float sx = scale / ratio, sy = scale;
+	forward << sx, 0, -sx * look_at[0],
+		0, sy, -sy * look_at[1],
+		0, 0, 1;
+	backward << 1 / sx, 0, look_at[0],
+		0, 1 / sy, look_at[1],
+		0, 0, 1;
+
+	// ndc = (2 x / width - 1, 2 (height - 1 - y) / height - 1), as the cursor
+	// positions were always converted
+	screen_gain = Eigen::Vector2f(2 / (viewport[0] * sx), -2 / (viewport[1] * sy));
+	screen_offset = Eigen::Vector2f(look_at[0] - 1 / sx, look_at[1] + (1 - 2 / viewport[1]) / sy);
+}
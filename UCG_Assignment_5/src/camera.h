@@ -0,0 +1,72 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <Eigen/Core>
+////////////////////////////////////////////////////////////////////////////////
+
+// 2D camera of the editor. World coordinates map to normalized device
+// coordinates through
+//
+//     ndc = zoom * [1 / aspect, 0; 0, 1] * (world - center)
+//
+// The view matrix and its inverse are kept up to date in closed form on every
+// change, so converting the cursor costs a few multiply-adds and never a
+// general matrix inverse. Screen coordinates are framebuffer pixels, with y
+// pointing down.
+class Camera2D {
+public:
+	Camera2D();
+
+	const Eigen::Vector2f &center() const { return look_at; }
+	float zoom() const { return scale; }
+	// Width over height of the area shown, 1 stretches it to the viewport
+	float aspect() const { return ratio; }
+
+	void set_center(const Eigen::Vector2f &center);
+	void set_zoom(float zoom);
+	void set_aspect(float aspect);
+
+	// Move the content on screen by offset, in normalized device coordinates
+	void pan(const Eigen::Vector2f &offset);
+
+	// Multiply the zoom, the center of the screen stays in place
+	void zoom_by(float factor);
+
+	// Take the center and zoom of an affine view matrix (such as one saved
+	// with a scene), its rotation and shear are dropped
+	void set_view(const Eigen::Matrix3f &view);
+
+	// World to normalized device coordinates, and back
+	const Eigen::Matrix3f &view() const { return forward; }
+	const Eigen::Matrix3f &inverse_view() const { return backward; }
+
+	// Size of the framebuffer, in pixels
+	void set_viewport(int width, int height);
+
+	Eigen::Vector2f world_to_ndc(const Eigen::Vector2f &p) const;
+	Eigen::Vector2f ndc_to_world(const Eigen::Vector2f &p) const;
+	Eigen::Vector2f screen_to_world(const Eigen::Vector2f &pixel) const;
+	Eigen::Vector2f world_to_screen(const Eigen::Vector2f &p) const;
+
+	// Convert n points stored as x, y pairs (in and out may be the same)
+	void screen_to_world(const float *in, float *out, int n) const;
+	void world_to_screen(const float *in, float *out, int n) const;
+
+	// World bounds of the screen rectangle with corners a and b
+	void screen_rect_to_world(const Eigen::Vector2f &a, const Eigen::Vector2f &b,
+		Eigen::Vector2f &min, Eigen::Vector2f &max) const;
+
+private:
+	Eigen::Vector2f look_at;
+	float scale;
+	float ratio;
+	Eigen::Vector2f viewport;
+
+	Eigen::Matrix3f forward;
+	Eigen::Matrix3f backward;
+	// Screen to world is x * gain + offset on each axis
+	Eigen::Vector2f screen_gain;
+	Eigen::Vector2f screen_offset;
+
+	void update();
+};
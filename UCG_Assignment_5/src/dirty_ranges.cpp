@@ -0,0 +1,63 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "dirty_ranges.h"
+#include <algorithm>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+bool ends_before(const DirtyRanges::Range &r, unsigned int begin) {
+	return r.end < begin;
+}
+
+} // anonymous namespace
+
+void DirtyRanges::add(unsigned int begin, unsigned int end) {
+	if (begin >= end) {
+		return;
+	}
+
+	// First range that overlaps or touches [begin, end)
+	std::vector<Range>::iterator first = std::lower_bound(ranges.begin(), ranges.end(), begin, ends_before);
+	std::vector<Range>::iterator last = first;
+	while (last != ranges.end() && last->begin <= end) {
+		begin = std::min(begin, last->begin);
+		end = std::max(end, last->end);
+		++last;
+	}
+
+	Range r = { begin, end };
+	if (first == last) {
+		ranges.insert(first, r);
+	} else {
+		*first = r;
+		ranges.erase(first + 1, last);
+	}
+
+	if (ranges.size() > max_ranges) {
+		merge_closest();
+	}
+}
+
+std::size_t DirtyRanges::columns() const {
+	std::size_t n = 0;
+	for (std::size_t i = 0; i < ranges.size(); ++i) {
+		n += ranges[i].end - ranges[i].begin;
+	}
+	return n;
+}
+
+void DirtyRanges::merge_closest() {
+	// Merge the pair separated by the smallest gap, this uploads the fewest
+	// clean columns for one range less
+	std::size_t best = 0;
+	unsigned int best_gap = ~0u;
+	for (std::size_t i = 0; i + 1 < ranges.size(); ++i) {
+		unsigned int gap = ranges[i + 1].begin - ranges[i].end;
+		if (gap < best_gap) {
+			best_gap = gap;
+			best = i;
+		}
+	}
+	ranges[best].end = ranges[best + 1].end;
+	ranges.erase(ranges.begin() + best + 1);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <vector>
+#include <cstddef>
+////////////////////////////////////////////////////////////////////////////////
+
+// Sorted set of disjoint half-open ranges [begin, end) of modified columns.
+//
+// Overlapping and touching ranges are merged on insertion. When more than
+// max_ranges disjoint ranges accumulate, the two closest neighbours are merged
+// so that a flush never issues more than max_ranges uploads.
+class DirtyRanges {
+public:
+	struct Range {
+		unsigned int begin;
+		unsigned int end;
+	};
+
+	std::vector<Range> ranges;
+	std::size_t max_ranges;
+
+	DirtyRanges() : max_ranges(32) { }
+
+	// Mark [begin, end) as modified
+	void add(unsigned int begin, unsigned int end);
+
+	// Forget every modified range
+	void clear() { ranges.clear(); }
+
+	bool empty() const { return ranges.empty(); }
+
+	// Total number of columns covered by the ranges
+	std::size_t columns() const;
+
+private:
+	void merge_closest();
+};
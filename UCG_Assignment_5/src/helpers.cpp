@@ -2,6 +2,8 @@
 #include "helpers.h"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 ////////////////////////////////////////////////////////////////////////////////
 
 void VertexArrayObject::init() {
@@ -32,16 +34,260 @@ void VertexBufferObject::bind() {
 }
 
 void VertexBufferObject::free() {
+	release_ring();
 	glDeleteBuffers(1,&id);
 	check_gl_error();
 }
 
 void VertexBufferObject::update(const Eigen::MatrixXf& M) {
+	update(M.data(), M.rows(), M.cols());
+}
+
+void VertexBufferObject::update(const float *data, GLuint rows, GLuint cols) {
+	invalidate(0, cols);
+	flush(data, rows, cols);
+}
+
+void VertexBufferObject::invalidate(GLuint first, GLuint count) {
+	dirty.add(first, first + count);
+}
+
+void VertexBufferObject::flush(const float *data, GLuint rows, GLuint cols) {
 	assert(id != 0);
+	if (streaming) {
+		stream(data, rows, cols);
+		return;
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, id);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*M.size(), M.data(), GL_DYNAMIC_DRAW);
-	rows = M.rows();
-	cols = M.cols();
+	uploaded_bytes = 0;
+	sent.clear();
+
+	if (rows != this->rows || cols > capacity) {
+		// Reallocate with some headroom, the previous content is lost so
+		// every valid column has to be sent again
+		GLuint new_capacity = std::max(cols, std::max(capacity * 2, (GLuint) 1024));
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float)*rows*new_capacity, NULL, GL_DYNAMIC_DRAW);
+		capacity = new_capacity;
+		dirty.clear();
+		dirty.add(0, cols);
+	}
+
+	for (size_t i = 0; i < dirty.ranges.size(); ++i) {
+		GLuint begin = dirty.ranges[i].begin;
+		GLuint end = std::min(dirty.ranges[i].end, cols);
+		if (begin >= end) {
+			continue;
+		}
+		size_t offset = sizeof(float)*rows*begin;
+		size_t size = sizeof(float)*rows*(end - begin);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, data + rows*begin);
+		uploaded_bytes += size;
+		sent.add(begin, end);
+	}
+	dirty.clear();
+
+	this->rows = rows;
+	this->cols = cols;
+	check_gl_error();
+}
+
+void VertexBufferObject::init_streaming(GLuint regions) {
+	assert(id != 0 && regions > 0);
+	release_ring();
+	streaming = true;
+	this->regions = regions;
+	region = 0;
+	pending.assign(regions, DirtyRanges());
+	fences.assign(regions, (GLsync) 0);
+	// Force the ring to be allocated and filled by the next flush
+	capacity = 0;
+	rows = 0;
+}
+
+void VertexBufferObject::fence() {
+	if (!streaming) {
+		return;
+	}
+	if (fences[region]) {
+		glDeleteSync(fences[region]);
+	}
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	check_gl_error();
+}
+
+size_t VertexBufferObject::offset() const {
+	return streaming ? sizeof(float)*rows*capacity*region : 0;
+}
+
+void VertexBufferObject::stream(const float *data, GLuint rows, GLuint cols) {
+	uploaded_bytes = 0;
+	sent.clear();
+	bool changed = !dirty.empty();
+
+	if (rows != this->rows || cols > capacity) {
+		allocate_ring(rows, std::max(cols, std::max(capacity * 2, (GLuint) 1024)));
+		for (GLuint r = 0; r < regions; ++r) {
+			pending[r].clear();
+			pending[r].add(0, cols);
+		}
+		changed = true;
+	} else {
+		// Every region has to catch up with the changes it has not seen yet
+		for (GLuint r = 0; r < regions; ++r) {
+			for (size_t i = 0; i < dirty.ranges.size(); ++i) {
+				pending[r].add(dirty.ranges[i].begin, dirty.ranges[i].end);
+			}
+		}
+	}
+	dirty.clear();
+	this->rows = rows;
+	this->cols = cols;
+
+	// The current region is up to date, keep drawing from it
+	if (!changed) {
+		return;
+	}
+
+	GLuint next = (region + 1) % regions;
+	wait_fence(next);
+
+	glBindBuffer(GL_ARRAY_BUFFER, id);
+	size_t base = sizeof(float)*rows*capacity*next;
+	const DirtyRanges &todo = pending[next];
+	for (size_t i = 0; i < todo.ranges.size(); ++i) {
+		GLuint begin = todo.ranges[i].begin;
+		GLuint end = std::min(todo.ranges[i].end, cols);
+		if (begin >= end) {
+			continue;
+		}
+		size_t offset = base + sizeof(float)*rows*begin;
+		size_t size = sizeof(float)*rows*(end - begin);
+		if (mapping) {
+			memcpy((char *) mapping + offset, data + rows*begin, size);
+		} else {
+			// The fence guarantees the GPU is done with this region, so the
+			// driver does not need to synchronize
+			GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+			void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, access);
+			memcpy(dst, data + rows*begin, size);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+		uploaded_bytes += size;
+		sent.add(begin, end);
+	}
+	pending[next].clear();
+	region = next;
+	check_gl_error();
+}
+
+void VertexBufferObject::allocate_ring(GLuint rows, GLuint capacity) {
+	release_ring();
+	size_t size = sizeof(float)*rows*capacity*regions;
+
+	bool persistent = false;
+#if defined(GL_VERSION_4_4)
+	persistent = persistent || GLAD_GL_VERSION_4_4;
+#endif
+#if defined(GL_ARB_buffer_storage)
+	persistent = persistent || GLAD_GL_ARB_buffer_storage;
+#endif
+
+#if defined(GL_VERSION_4_4) || defined(GL_ARB_buffer_storage)
+	if (persistent) {
+		// Immutable storage cannot be resized, start from a fresh buffer object
+		glDeleteBuffers(1, &id);
+		glGenBuffers(1, &id);
+		glBindBuffer(GL_ARRAY_BUFFER, id);
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+		mapping = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+	}
+#endif
+	if (!persistent) {
+		glBindBuffer(GL_ARRAY_BUFFER, id);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+
+	this->capacity = capacity;
+	region = 0;
+	check_gl_error();
+}
+
+void VertexBufferObject::release_ring() {
+	for (size_t r = 0; r < fences.size(); ++r) {
+		if (fences[r]) {
+			glDeleteSync(fences[r]);
+			fences[r] = 0;
+		}
+	}
+	if (mapping) {
+		glBindBuffer(GL_ARRAY_BUFFER, id);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		mapping = NULL;
+	}
+}
+
+void VertexBufferObject::wait_fence(GLuint r) {
+	if (!fences[r]) {
+		return;
+	}
+	GLenum status = glClientWaitSync(fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+	while (status == GL_TIMEOUT_EXPIRED) {
+		status = glClientWaitSync(fences[r], 0, 1000000);
+	}
+	glDeleteSync(fences[r]);
+	fences[r] = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void BufferTexture::init(const VertexBufferObject &buffer, GLenum format) {
+	// The buffer object only exists once it has been bound
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer.id);
+	glGenTextures(1, &id);
+	glBindTexture(GL_TEXTURE_BUFFER, id);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, buffer.id);
+	check_gl_error();
+}
+
+void BufferTexture::bind(unsigned int unit) {
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, id);
+	check_gl_error();
+}
+
+void BufferTexture::free() {
+	glDeleteTextures(1, &id);
+	check_gl_error();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void IndexBufferObject::init() {
+	glGenBuffers(1, &id);
+	check_gl_error();
+}
+
+void IndexBufferObject::update(const unsigned int *indices, size_t count) {
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+	if (count > capacity) {
+		capacity = std::max(count, std::max(capacity * 2, (size_t) 3072));
+	}
+	// Orphan the previous content, the GPU may still be reading it
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int)*capacity, NULL, GL_STREAM_DRAW);
+	if (count > 0) {
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(unsigned int)*count, indices);
+	}
+	check_gl_error();
+}
+
+void IndexBufferObject::bind() {
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+	check_gl_error();
+}
+
+void IndexBufferObject::free() {
+	glDeleteBuffers(1, &id);
 	check_gl_error();
 }
 
@@ -79,6 +325,103 @@ bool Program::init(
 		return false;
 	}
 
+	introspect();
+
+	check_gl_error();
+	return true;
+}
+
+namespace {
+
+bool variable_less(const Program::Variable &a, const Program::Variable &b) {
+	return a.name < b.name;
+}
+
+} // anonymous namespace
+
+void Program::introspect() {
+	attributes.clear();
+	uniforms.clear();
+
+	GLint count, max_length;
+	std::vector<char> name;
+
+	glGetProgramiv(program_shader, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(program_shader, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+	name.resize(max_length + 1);
+	for (GLint i = 0; i < count; ++i) {
+		GLint size;
+		Variable v;
+		glGetActiveAttrib(program_shader, i, (GLsizei) name.size(), NULL, &size, &v.type, name.data());
+		v.name = name.data();
+		v.location = glGetAttribLocation(program_shader, name.data());
+		v.has_value = false;
+		attributes.push_back(v);
+	}
+
+	glGetProgramiv(program_shader, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program_shader, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	name.resize(max_length + 1);
+	for (GLint i = 0; i < count; ++i) {
+		GLint size;
+		Variable v;
+		glGetActiveUniform(program_shader, i, (GLsizei) name.size(), NULL, &size, &v.type, name.data());
+		v.location = glGetUniformLocation(program_shader, name.data());
+		if (v.location < 0) {
+			// Member of a uniform block
+			continue;
+		}
+		// Arrays are reported as "name[0]", look them up by their plain name
+		v.name = name.data();
+		size_t bracket = v.name.find('[');
+		if (bracket != std::string::npos) {
+			v.name.resize(bracket);
+		}
+		v.has_value = false;
+		uniforms.push_back(v);
+	}
+
+	std::sort(attributes.begin(), attributes.end(), variable_less);
+	std::sort(uniforms.begin(), uniforms.end(), variable_less);
+	check_gl_error();
+}
+
+int Program::find(const std::vector<Variable> &table, const std::string &name) {
+	Variable key;
+	key.name = name;
+	std::vector<Variable>::const_iterator it = std::lower_bound(table.begin(), table.end(), key, variable_less);
+	if (it == table.end() || it->name != name) {
+		return -1;
+	}
+	return (int) (it - table.begin());
+}
+
+bool Program::set_uniform(int slot, const void *data, size_t bytes) {
+	assert(slot >= 0 && slot < (int) uniforms.size());
+	assert(bytes <= sizeof(uniforms[slot].value));
+	Variable &u = uniforms[slot];
+	if (u.has_value && memcmp(u.value, data, bytes) == 0) {
+		return false;
+	}
+	memcpy(u.value, data, bytes);
+	u.has_value = true;
+
+	const GLfloat *f = (const GLfloat *) data;
+	const GLint *i = (const GLint *) data;
+	switch (u.type) {
+		case GL_FLOAT:        glUniform1fv(u.location, 1, f); break;
+		case GL_FLOAT_VEC2:   glUniform2fv(u.location, 1, f); break;
+		case GL_FLOAT_VEC3:   glUniform3fv(u.location, 1, f); break;
+		case GL_FLOAT_VEC4:   glUniform4fv(u.location, 1, f); break;
+		case GL_FLOAT_MAT2:   glUniformMatrix2fv(u.location, 1, GL_FALSE, f); break;
+		case GL_FLOAT_MAT3:   glUniformMatrix3fv(u.location, 1, GL_FALSE, f); break;
+		case GL_FLOAT_MAT4:   glUniformMatrix4fv(u.location, 1, GL_FALSE, f); break;
+		case GL_INT_VEC2:     glUniform2iv(u.location, 1, i); break;
+		case GL_INT_VEC3:     glUniform3iv(u.location, 1, i); break;
+		case GL_INT_VEC4:     glUniform4iv(u.location, 1, i); break;
+		// Scalars, booleans and samplers
+		default:              glUniform1iv(u.location, 1, i); break;
+	}
 	check_gl_error();
 	return true;
 }
@@ -89,11 +432,13 @@ void Program::bind() {
 }
 
 GLint Program::attrib(const std::string &name) const {
-	return glGetAttribLocation(program_shader, name.c_str());
+	int slot = find(attributes, name);
+	return slot < 0 ? -1 : attributes[slot].location;
 }
 
 GLint Program::uniform(const std::string &name) const {
-	return glGetUniformLocation(program_shader, name.c_str());
+	int slot = find(uniforms, name);
+	return slot < 0 ? -1 : uniforms[slot].location;
 }
 
 GLint Program::bindVertexAttribArray(const std::string &v_name, const std::string &c_name, VertexBufferObject& VBO) const {
@@ -123,7 +468,26 @@ GLint Program::bindVertexAttribArray(const std::string &v_name, const std::strin
 	return v_id;
 }
 
+GLint Program::bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const {
+	GLint id = attrib(name);
+	if (id < 0) {
+		return id;
+	}
+	if (VBO.id == 0) {
+		glDisableVertexAttribArray(id);
+		return id;
+	}
+	VBO.bind();
+	glEnableVertexAttribArray(id);
+	glVertexAttribPointer(id, VBO.rows, GL_FLOAT, GL_FALSE, 0, (GLvoid*) VBO.offset());
+	check_gl_error();
+
+	return id;
+}
+
 void Program::free() {
+	attributes.clear();
+	uniforms.clear();
 	if (program_shader) {
 		glDeleteProgram(program_shader);
 		program_shader = 0;
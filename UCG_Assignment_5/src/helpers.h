@@ -3,6 +3,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <glad/glad.h>
 #include <Eigen/Core>
+#include "dirty_ranges.h"
 #include <vector>
 #include <string>
 ////////////////////////////////////////////////////////////////////////////////
@@ -34,7 +35,31 @@ public:
 	GLuint rows;
 	GLuint cols;
 
-	VertexBufferObject() : id(0), rows(0), cols(0) { }
+	// Number of columns allocated on the GPU (cols <= capacity)
+	GLuint capacity;
+
+	// Columns modified since the last flush
+	DirtyRanges dirty;
+
+	// Number of bytes sent to the GPU by the last flush
+	size_t uploaded_bytes;
+
+	// Columns sent to the GPU by the last flush
+	DirtyRanges sent;
+
+	// Streaming mode: the buffer holds a ring of regions copies of the stream.
+	// Each flush writes the next region through a mapping while the GPU may
+	// still read the previous ones, fences keep the CPU from overwriting a
+	// region that is in flight.
+	bool streaming;
+	GLuint regions;
+	GLuint region;
+	void *mapping;
+	std::vector<DirtyRanges> pending;
+	std::vector<GLsync> fences;
+
+	VertexBufferObject() : id(0), rows(0), cols(0), capacity(0), uploaded_bytes(0),
+		streaming(false), regions(1), region(0), mapping(NULL) { }
 
 	// Create a new empty VBO
 	void init();
@@ -42,15 +67,93 @@ public:
 	// Updates the VBO with a matrix M
 	void update(const Eigen::MatrixXf& M);
 
+	// Updates the VBO with cols columns of rows floats each (column-major)
+	void update(const float *data, GLuint rows, GLuint cols);
+
+	// Mark count columns starting at first as modified
+	void invalidate(GLuint first, GLuint count);
+
+	// Upload the modified columns of data, which holds cols columns of rows floats.
+	// The allocation is kept between calls and grows geometrically when cols
+	// exceeds the capacity.
+	void flush(const float *data, GLuint rows, GLuint cols);
+
+	// Switch to streaming mode with a ring of the given number of regions.
+	// The storage is persistently mapped when the context supports it,
+	// otherwise every region is written with an unsynchronized glMapBufferRange.
+	void init_streaming(GLuint regions = 3);
+
+	// Fence the current region, call once the draw calls reading it are issued
+	void fence();
+
+	// Byte offset of the region holding the most recent data
+	size_t offset() const;
+
 	// Select this VBO for subsequent draw calls
 	void bind();
 
+	// Release the id
+	void free();
+
+private:
+	void stream(const float *data, GLuint rows, GLuint cols);
+	void allocate_ring(GLuint rows, GLuint capacity);
+	void release_ring();
+	void wait_fence(GLuint r);
+};
+
+// -----------------------------------------------------------------------------
+
+// Buffer texture exposing the content of a VertexBufferObject to shaders,
+// which read it with texelFetch on a samplerBuffer
+class BufferTexture {
+public:
+	unsigned int id;
+
+	BufferTexture() : id(0) { }
+
+	// Create the texture and attach buffer to it, format is the internal format
+	// of one texel (GL_RG32F, GL_RGBA32F, ...)
+	void init(const VertexBufferObject &buffer, GLenum format);
+
+	// Bind to texture unit GL_TEXTURE0 + unit
+	void bind(unsigned int unit);
+
 	// Release the id
 	void free();
 };
 
 // -----------------------------------------------------------------------------
 
+// Element array of vertex indices, bound to the current VAO
+class IndexBufferObject {
+public:
+	unsigned int id;
+
+	// Number of indices allocated on the GPU
+	size_t capacity;
+
+	IndexBufferObject() : id(0), capacity(0) { }
+
+	// Create a new empty buffer
+	void init();
+
+	// Replace the content with count indices. The storage is orphaned so the
+	// draws still reading it do not stall the upload, its size grows
+	// geometrically.
+	void update(const unsigned int *indices, size_t count);
+
+	// Bind to the current VAO
+	void bind();
+
+	// Release the id
+	void free();
+};
+
+// -----------------------------------------------------------------------------
+
+template <typename T> class Uniform;
+
 // This class wraps an OpenGL program composed of two shaders
 class Program {
 public:
@@ -61,6 +164,20 @@ public:
 	GLuint fragment_shader;
 	GLuint program_shader;
 
+	// Active attribute or uniform found when the program was linked
+	struct Variable {
+		std::string name;
+		GLint location;
+		GLenum type;
+		// Shadow copy of the last value sent (uniforms only)
+		bool has_value;
+		unsigned char value[64];
+	};
+
+	// Both tables are sorted by name
+	std::vector<Variable> attributes;
+	std::vector<Variable> uniforms;
+
 	Program() : vertex_shader(0), fragment_shader(0), program_shader(0) { }
 
 	// Create a new shader from the specified source strings
@@ -80,10 +197,51 @@ public:
 	// Return the OpenGL handle of a uniform attribute (-1 if it does not exist)
 	GLint uniform(const std::string &name) const;
 
+	// Return a typed handle of a uniform resolved once, the handle is only
+	// valid until the program is re-initialized
+	template <typename T>
+	Uniform<T> uniform_handle(const std::string &name) { return Uniform<T>(this, find(uniforms, name)); }
+
+	// Send the value of uniform slot (index in uniforms) unless it equals the
+	// shadow copy, the program must be bound. Returns true if glUniform was called.
+	bool set_uniform(int slot, const void *data, size_t bytes);
+
 	// Bind a per-vertex array attribute
     GLint bindVertexAttribArray(const std::string &v_name, const std::string &c_name, VertexBufferObject& VBO) const;
 
+	// Bind a per-vertex array attribute stored in its own VBO (one column per vertex)
+	GLint bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const;
+
 	GLuint create_shader_helper(GLint type, const std::string &shader_string);
+
+private:
+	void introspect();
+	static int find(const std::vector<Variable> &table, const std::string &name);
+};
+
+// -----------------------------------------------------------------------------
+
+// Uniform of type T resolved at link time. Setting it to the value it already
+// holds does not reach OpenGL.
+template <typename T>
+class Uniform {
+public:
+	Uniform() : program(NULL), slot(-1) { }
+	Uniform(Program *program, int slot) : program(program), slot(slot) { }
+
+	// False if the uniform is not active in the program
+	bool valid() const { return slot >= 0; }
+
+	// T must be a plain value (float, int or a fixed-size Eigen matrix)
+	void set(const T &value) {
+		if (slot >= 0) {
+			program->set_uniform(slot, &value, sizeof(T));
+		}
+	}
+
+private:
+	Program *program;
+	int slot;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "history.h"
+#include <cassert>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+Edit snapshot(Edit::Kind kind, const TriangleStore &store, int t) {
+	Edit e;
+	e.kind = kind;
+	e.first = t;
+	e.last = t + 1;
+	for (int i = 0; i < 3; ++i) {
+		e.triangle.positions[i * 2] = store.positions(0, t * 3 + i);
+		e.triangle.positions[i * 2 + 1] = store.positions(1, t * 3 + i);
+		for (int c = 0; c < 3; ++c) {
+			e.triangle.colors[i * 3 + c] = store.colors(c, t * 3 + i);
+		}
+	}
+	return e;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+Edit Edit::insert(const TriangleStore &store, int t) {
+	return snapshot(Insert, store, t);
+}
+
+Edit Edit::remove(const TriangleStore &store, const KeyframeStore &keyframes, int t) {
+	Edit e = snapshot(Delete, store, t);
+	int o = keyframes.find(t);
+	if (o != -1) {
+		keyframes.save(o, e.keys);
+	}
+	return e;
+}
+
+Edit Edit::transformed(int begin, int end, const TriangleTransform &m) {
+	Edit e;
+	e.kind = Transform;
+	e.first = begin;
+	e.last = end;
+	Eigen::Map<Eigen::Matrix2f>(e.transform.linear) = m.linear;
+	Eigen::Map<Eigen::Vector2f>(e.transform.offset) = m.offset;
+	Eigen::Map<Eigen::Vector2f>(e.transform.pivot) = m.pivot;
+	e.transform.about_barycenter = m.about_barycenter;
+	return e;
+}
+
+Edit Edit::recolor(int v, const Eigen::Vector3f &before, const Eigen::Vector3f &after) {
+	Edit e;
+	e.kind = Recolor;
+	e.first = v;
+	e.last = v + 1;
+	Eigen::Map<Eigen::Vector3f>(e.color.before) = before;
+	Eigen::Map<Eigen::Vector3f>(e.color.after) = after;
+	return e;
+}
+
+Eigen::Matrix<float, 2, 3> Edit::vertices() const {
+	assert(kind == Insert || kind == Delete);
+	return Eigen::Map<const Eigen::Matrix<float, 2, 3> >(triangle.positions);
+}
+
+Eigen::Vector3f Edit::vertex_color(int i) const {
+	assert(kind == Insert || kind == Delete);
+	return Eigen::Map<const Eigen::Vector3f>(&triangle.colors[i * 3]);
+}
+
+TriangleTransform Edit::matrix() const {
+	assert(kind == Transform);
+	TriangleTransform m;
+	m.linear = Eigen::Map<const Eigen::Matrix2f>(transform.linear);
+	m.offset = Eigen::Map<const Eigen::Vector2f>(transform.offset);
+	m.pivot = Eigen::Map<const Eigen::Vector2f>(transform.pivot);
+	m.about_barycenter = transform.about_barycenter;
+	return m;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void EditHistory::set_budget(size_t bytes) {
+	limit = bytes;
+	trim();
+}
+
+void EditHistory::record(const Edit &e) {
+	for (size_t i = done; i < edits.size(); ++i) {
+		keys -= key_bytes(edits[i]);
+	}
+	edits.resize(done);
+	edits.push_back(e);
+	keys += key_bytes(edits.back());
+	done = edits.size();
+	trim();
+}
+
+Edit &EditHistory::undo() {
+	assert(can_undo());
+	return edits[--done];
+}
+
+Edit &EditHistory::redo() {
+	assert(can_redo());
+	return edits[done++];
+}
+
+void EditHistory::save_keys(Edit &e, const KeyframeStore &keyframes) {
+	assert(e.kind == Edit::Insert || e.kind == Edit::Delete);
+	keys -= key_bytes(e);
+	std::vector<float>().swap(e.keys);
+	int o = keyframes.find(e.first);
+	if (o != -1) {
+		keyframes.save(o, e.keys);
+	}
+	keys += key_bytes(e);
+}
+
+void EditHistory::clear() {
+	edits.clear();
+	done = 0;
+	keys = 0;
+}
+
+void EditHistory::trim() {
+	// Forget the oldest edits first, they are the last ones to be undone. When
+	// everything was undone, the edits furthest from being redone go instead.
+	while (edits.size() > 1 && bytes() > limit) {
+		if (done > 0) {
+			keys -= key_bytes(edits.front());
+			edits.pop_front();
+			--done;
+		} else {
+			keys -= key_bytes(edits.back());
+			edits.pop_back();
+		}
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "transform.h"
+#include "keyframes.h"
+#include <cstddef>
+#include <deque>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// One undoable edit of the triangle soup, small enough that a long history
+// costs less than a copy of a large scene. Transforms are kept as the
+// transform itself and reverted with its inverse, so undoing a rotation of
+// the whole scene touches the positions once and copies nothing. Only the
+// removal of an animated triangle carries more, its key frames.
+struct Edit {
+	enum Kind {
+		// Triangle first was appended / erased (see TriangleStore::erase)
+		Insert,
+		Delete,
+		// Triangles [first, last) were transformed
+		Transform,
+		// The color of vertex first changed
+		Recolor,
+	};
+
+	Kind kind;
+	int first;
+	int last;
+
+	union {
+		// Insert and Delete: the triangle as it was in the store
+		struct {
+			float positions[6];
+			float colors[9];
+		} triangle;
+		// Transform: the fields of a TriangleTransform
+		struct {
+			float linear[4];
+			float offset[2];
+			float pivot[2];
+			bool about_barycenter;
+		} transform;
+		// Recolor
+		struct {
+			float before[3];
+			float after[3];
+		} color;
+	};
+
+	// Insert and Delete: the key frames of the triangle when it was removed
+	// (see KeyframeStore::save), empty if it was not animated
+	std::vector<float> keys;
+
+	static Edit insert(const TriangleStore &store, int t);
+	static Edit remove(const TriangleStore &store, const KeyframeStore &keyframes, int t);
+	static Edit transformed(int begin, int end, const TriangleTransform &m);
+	static Edit recolor(int v, const Eigen::Vector3f &before, const Eigen::Vector3f &after);
+
+	// Vertices (one per column) and vertex colors of an inserted or deleted triangle
+	Eigen::Matrix<float, 2, 3> vertices() const;
+	Eigen::Vector3f vertex_color(int i) const;
+
+	TriangleTransform matrix() const;
+};
+
+// Undo / redo log of the edits, its memory is bounded: the oldest edits are
+// forgotten when the budget is exceeded. Recording an edit after some undos
+// discards the edits that could have been redone.
+class EditHistory {
+public:
+	explicit EditHistory(size_t budget = 4 << 20) : done(0), limit(budget), keys(0) { }
+
+	// Memory allowed for the log, in bytes (at least one edit is kept)
+	size_t budget() const { return limit; }
+	void set_budget(size_t bytes);
+
+	// Memory used by the log, in bytes
+	size_t bytes() const { return edits.size() * sizeof(Edit) + keys; }
+
+	void record(const Edit &e);
+
+	bool can_undo() const { return done > 0; }
+	bool can_redo() const { return done < edits.size(); }
+
+	// Edit to revert / to apply again, the caller changes the scene
+	Edit &undo();
+	Edit &redo();
+
+	// The triangle of e, an Insert or Delete edit returned by undo or redo,
+	// is about to be removed: keep its current key frames in e so that
+	// restoring it brings them back. The budget applies from the next record.
+	void save_keys(Edit &e, const KeyframeStore &keyframes);
+
+	void clear();
+
+private:
+	std::deque<Edit> edits;
+	// Edits [0, done) are applied, the others were undone
+	size_t done;
+	size_t limit;
+	// Memory of the key frames of the edits
+	size_t keys;
+
+	static size_t key_bytes(const Edit &e) { return e.keys.capacity() * sizeof(float); }
+
+	void trim();
+};
@@ -0,0 +1,239 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "hit_test.h"
+#include <algorithm>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Offsets of the six coordinate arrays inside a gathered block
+enum { AX = 0, AY = 1, BX = 2, BY = 3, CX = 4, CY = 5 };
+
+// Bit i of the result is set when triangle i of the block contains (x, y)
+typedef unsigned int (*BlockKernel)(const float *block, float x, float y);
+
+// A point is outside when its edge functions have both signs, which keeps the
+// test independent of the winding order and inclusive on the edges. A
+// triangle of zero area contains nothing, otherwise a point triangle would
+// contain every point (all its edge functions are zero).
+inline bool inside(float ax, float ay, float bx, float by, float cx, float cy, float x, float y) {
+	float area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+	if (area == 0) {
+		return false;
+	}
+	float e0 = (bx - ax) * (y - ay) - (by - ay) * (x - ax);
+	float e1 = (cx - bx) * (y - by) - (cy - by) * (x - bx);
+	float e2 = (ax - cx) * (y - cy) - (ay - cy) * (x - cx);
+	float lo = std::min(e0, std::min(e1, e2));
+	float hi = std::max(e0, std::max(e1, e2));
+	return !(lo < 0 && hi > 0);
+}
+
+unsigned int block_scalar(const float *block, float x, float y) {
+	const int n = hit_test_block;
+	unsigned int mask = 0;
+	for (int i = 0; i < n; ++i) {
+		if (inside(block[AX * n + i], block[AY * n + i], block[BX * n + i], block[BY * n + i],
+			block[CX * n + i], block[CY * n + i], x, y))
+		{
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse2")
+unsigned int block_sse2(const float *block, float x, float y) {
+	const int n = hit_test_block;
+	const __m128 px = _mm_set1_ps(x);
+	const __m128 py = _mm_set1_ps(y);
+	const __m128 zero = _mm_setzero_ps();
+	unsigned int mask = 0;
+	for (int i = 0; i < n; i += 4) {
+		__m128 ax = _mm_load_ps(block + AX * n + i), ay = _mm_load_ps(block + AY * n + i);
+		__m128 bx = _mm_load_ps(block + BX * n + i), by = _mm_load_ps(block + BY * n + i);
+		__m128 cx = _mm_load_ps(block + CX * n + i), cy = _mm_load_ps(block + CY * n + i);
+		__m128 e0 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(bx, ax), _mm_sub_ps(py, ay)),
+			_mm_mul_ps(_mm_sub_ps(by, ay), _mm_sub_ps(px, ax)));
+		__m128 e1 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(cx, bx), _mm_sub_ps(py, by)),
+			_mm_mul_ps(_mm_sub_ps(cy, by), _mm_sub_ps(px, bx)));
+		__m128 e2 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(ax, cx), _mm_sub_ps(py, cy)),
+			_mm_mul_ps(_mm_sub_ps(ay, cy), _mm_sub_ps(px, cx)));
+		__m128 area = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(bx, ax), _mm_sub_ps(cy, ay)),
+			_mm_mul_ps(_mm_sub_ps(by, ay), _mm_sub_ps(cx, ax)));
+		__m128 lo = _mm_min_ps(e0, _mm_min_ps(e1, e2));
+		__m128 hi = _mm_max_ps(e0, _mm_max_ps(e1, e2));
+		__m128 outside = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(lo, zero), _mm_cmpgt_ps(hi, zero)),
+			_mm_cmpeq_ps(area, zero));
+		mask |= (unsigned int) (~_mm_movemask_ps(outside) & 0xf) << i;
+	}
+	return mask;
+}
+
+SIMD_TARGET("avx2")
+unsigned int block_avx2(const float *block, float x, float y) {
+	const int n = hit_test_block;
+	const __m256 px = _mm256_set1_ps(x);
+	const __m256 py = _mm256_set1_ps(y);
+	const __m256 zero = _mm256_setzero_ps();
+	unsigned int mask = 0;
+	for (int i = 0; i < n; i += 8) {
+		__m256 ax = _mm256_load_ps(block + AX * n + i), ay = _mm256_load_ps(block + AY * n + i);
+		__m256 bx = _mm256_load_ps(block + BX * n + i), by = _mm256_load_ps(block + BY * n + i);
+		__m256 cx = _mm256_load_ps(block + CX * n + i), cy = _mm256_load_ps(block + CY * n + i);
+		__m256 e0 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(bx, ax), _mm256_sub_ps(py, ay)),
+			_mm256_mul_ps(_mm256_sub_ps(by, ay), _mm256_sub_ps(px, ax)));
+		__m256 e1 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(cx, bx), _mm256_sub_ps(py, by)),
+			_mm256_mul_ps(_mm256_sub_ps(cy, by), _mm256_sub_ps(px, bx)));
+		__m256 e2 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(ax, cx), _mm256_sub_ps(py, cy)),
+			_mm256_mul_ps(_mm256_sub_ps(ay, cy), _mm256_sub_ps(px, cx)));
+		__m256 area = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(bx, ax), _mm256_sub_ps(cy, ay)),
+			_mm256_mul_ps(_mm256_sub_ps(by, ay), _mm256_sub_ps(cx, ax)));
+		__m256 lo = _mm256_min_ps(e0, _mm256_min_ps(e1, e2));
+		__m256 hi = _mm256_max_ps(e0, _mm256_max_ps(e1, e2));
+		__m256 outside = _mm256_or_ps(_mm256_and_ps(_mm256_cmp_ps(lo, zero, _CMP_LT_OQ), _mm256_cmp_ps(hi, zero, _CMP_GT_OQ)),
+			_mm256_cmp_ps(area, zero, _CMP_EQ_OQ));
+		mask |= (unsigned int) (~_mm256_movemask_ps(outside) & 0xff) << i;
+	}
+	return mask;
+}
+
+#endif // SIMD_X86
+
+BlockKernel block_kernel(SimdLevel k) {
+	switch (k) {
+#ifdef SIMD_X86
+		case SimdSSE2: return block_sse2;
+		case SimdAVX2: return block_avx2;
+#endif
+		default: return block_scalar;
+	}
+}
+
+// Kernel in use, detected on the first call
+SimdLevel &active_kernel() {
+	static SimdLevel k = simd_best();
+	return k;
+}
+
+BlockKernel &active_block() {
+	static BlockKernel f = block_kernel(active_kernel());
+	return f;
+}
+
+// Structure-of-arrays copy of up to hit_test_block triangles
+struct Block {
+	alignas(32) float data[6 * hit_test_block];
+	int count;
+
+	Block() : count(0) { }
+
+	void push(const float *p) {
+		const int n = hit_test_block;
+		data[AX * n + count] = p[0];
+		data[AY * n + count] = p[1];
+		data[BX * n + count] = p[3];
+		data[BY * n + count] = p[4];
+		data[CX * n + count] = p[6];
+		data[CY * n + count] = p[7];
+		++count;
+	}
+
+	// Run the kernel, lanes past count are masked out
+	unsigned int test(float x, float y) const {
+		unsigned int mask = active_block()(data, x, y);
+		if (count < hit_test_block) {
+			mask &= (1u << count) - 1;
+		}
+		return mask;
+	}
+};
+
+// Index of the highest set bit of a non-zero mask
+int highest_bit(unsigned int mask) {
+	int i = 0;
+	while (mask >>= 1) {
+		++i;
+	}
+	return i;
+}
+
+// Index of the lowest set bit of a non-zero mask
+int lowest_bit(unsigned int mask) {
+	return highest_bit(mask & (~mask + 1));
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+SimdLevel hit_test_kernel() {
+	return active_kernel();
+}
+
+bool set_hit_test_kernel(SimdLevel k) {
+	if (!simd_supported(k)) {
+		return false;
+	}
+	active_kernel() = k;
+	active_block() = block_kernel(k);
+	return true;
+}
+
+int hit_test_topmost(const TriangleStore &store, const int *candidates, int n, float x, float y) {
+	const float *positions = store.position_data();
+	int best = -1;
+	Block block;
+	for (int i = 0; i < n; i += block.count) {
+		block.count = 0;
+		for (int j = i; j < n && block.count < hit_test_block; ++j) {
+			block.push(positions + candidates[j] * 9);
+		}
+		unsigned int mask = block.test(x, y);
+		for (; mask; mask &= mask - 1) {
+			int t = candidates[i + lowest_bit(mask)];
+			best = std::max(best, t);
+		}
+	}
+	return best;
+}
+
+int hit_test_topmost(const TriangleStore &store, int n, float x, float y) {
+	const float *positions = store.position_data();
+	Block block;
+	for (int end = n; end > 0; end -= block.count) {
+		int begin = std::max(0, end - hit_test_block);
+		block.count = 0;
+		for (int t = begin; t < end; ++t) {
+			block.push(positions + t * 9);
+		}
+		unsigned int mask = block.test(x, y);
+		if (mask) {
+			return begin + highest_bit(mask);
+		}
+	}
+	return -1;
+}
+
+void hit_test_all(const TriangleStore &store, const int *candidates, int n, float x, float y,
+	std::vector<int> &out)
+{
+	const float *positions = store.position_data();
+	Block block;
+	for (int i = 0; i < n; i += block.count) {
+		block.count = 0;
+		for (int j = i; j < n && block.count < hit_test_block; ++j) {
+			block.push(positions + candidates[j] * 9);
+		}
+		unsigned int mask = block.test(x, y);
+		for (; mask; mask &= mask - 1) {
+			out.push_back(candidates[i + lowest_bit(mask)]);
+		}
+	}
+}
+
+bool point_in_triangle(const TriangleStore &store, int t, float x, float y) {
+	const float *p = store.position_data() + t * 9;
+	return inside(p[0], p[1], p[3], p[4], p[6], p[7], x, y);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "simd.h"
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Batched point-in-triangle tests.
+//
+// Triangles are gathered by blocks of hit_test_block into a structure-of-arrays
+// layout (the a.x of every triangle, then every a.y, ...) and tested against a
+// single point with edge functions, without any division. The block kernel is
+// picked on first use from the instruction sets supported by the CPU, with a
+// scalar fallback on every other platform.
+
+// Number of triangles tested by one call to the block kernel
+const int hit_test_block = 16;
+
+// Kernel used by the functions below, the best supported one by default
+SimdLevel hit_test_kernel();
+
+// Use kernel k from now on, returns false (and keeps the current kernel) if it
+// is not supported
+bool set_hit_test_kernel(SimdLevel k);
+
+// Highest triangle index among the n candidates that contains (x, y), -1 if none
+int hit_test_topmost(const TriangleStore &store, const int *candidates, int n, float x, float y);
+
+// Highest index among the first n triangles of store that contains (x, y), -1
+// if none. Scans from the top and stops at the first block with a hit.
+int hit_test_topmost(const TriangleStore &store, int n, float x, float y);
+
+// Append to out, in candidate order, every candidate that contains (x, y)
+void hit_test_all(const TriangleStore &store, const int *candidates, int n, float x, float y,
+	std::vector<int> &out);
+
+// Edge-function test of the point (x, y) against triangle t, inclusive on the
+// edges and independent of the winding order
+bool point_in_triangle(const TriangleStore &store, int t, float x, float y);
@@ -0,0 +1,583 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "importers.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Color of the triangles of files without colors
+const float default_color[3] = { 0.5f, 0.5f, 0.5f };
+
+const size_t no_error = (size_t) -1;
+
+enum Format { STL, OBJ, CSV, Unknown };
+
+Format format_of(const std::string &path) {
+	size_t dot = path.rfind('.');
+	std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+	for (size_t i = 0; i < ext.size(); ++i) {
+		ext[i] = (char) std::tolower((unsigned char) ext[i]);
+	}
+	return ext == "stl" ? STL : ext == "obj" ? OBJ : ext == "csv" ? CSV : Unknown;
+}
+
+// -----------------------------------------------------------------------------
+// Numbers
+
+inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+inline void skip_blanks(const char *&p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+		++p;
+	}
+}
+
+// Powers of ten that are exact in a double
+const double exact_powers[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Decimal number with an optional sign, fraction and exponent. Up to 19
+// significant digits are kept, which is far more than a float holds.
+bool parse_float(const char *&p, const char *end, float &out) {
+	const char *s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s++ == '-';
+	}
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; s < end && is_digit(*s); ++s) {
+		any = true;
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (uint64_t) (*s - '0');
+			digits += mantissa != 0;
+		} else {
+			++exponent;
+		}
+	}
+	if (s < end && *s == '.') {
+		for (++s; s < end && is_digit(*s); ++s) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (uint64_t) (*s - '0');
+				digits += mantissa != 0;
+				--exponent;
+			}
+		}
+	}
+	if (!any) {
+		return false;
+	}
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		++s;
+		bool negative_exponent = false;
+		if (s < end && (*s == '-' || *s == '+')) {
+			negative_exponent = *s++ == '-';
+		}
+		if (s == end || !is_digit(*s)) {
+			return false;
+		}
+		int e = 0;
+		for (; s < end && is_digit(*s); ++s) {
+			e = std::min(e * 10 + (*s - '0'), 100000);
+		}
+		exponent += negative_exponent ? -e : e;
+	}
+
+	double v = (double) mantissa;
+	if (mantissa != 0 && exponent != 0) {
+		if (exponent >= -22 && exponent <= 22 && mantissa < ((uint64_t) 1 << 53)) {
+			// Exact operands, the result is correctly rounded
+			v = exponent < 0 ? v / exact_powers[-exponent] : v * exact_powers[exponent];
+		} else {
+			v *= std::pow(10.0, (double) exponent);
+		}
+	}
+	out = (float) (negative ? -v : v);
+	p = s;
+	return true;
+}
+
+bool parse_int(const char *&p, const char *end, long long &out) {
+	const char *s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = *s++ == '-';
+	}
+	if (s == end || !is_digit(*s)) {
+		return false;
+	}
+	long long v = 0;
+	for (; s < end && is_digit(*s); ++s) {
+		v = std::min(v * 10 + (*s - '0'), (long long) 1 << 40);
+	}
+	out = negative ? -v : v;
+	p = s;
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// Chunks
+
+// Reads a text file by chunks that end on a line boundary, the partial line at
+// the end of a chunk starts the next one
+class LineChunks {
+public:
+	LineChunks(FILE *file, size_t size) : file(file), buffer(size), filled(0), consumed(0), offset(0) { }
+
+	// Next chunk [data, data + n), n is 0 at the end of the file. Returns
+	// false on a read error or a line longer than a chunk.
+	bool next(const char *&data, size_t &n) {
+		offset += consumed;
+		filled -= consumed;
+		std::memmove(buffer.data(), buffer.data() + consumed, filled);
+		consumed = 0;
+
+		size_t read = std::fread(buffer.data() + filled, 1, buffer.size() - filled, file);
+		if (std::ferror(file)) {
+			return false;
+		}
+		bool last = filled + read < buffer.size();
+		filled += read;
+
+		size_t end = filled;
+		if (!last) {
+			const char *newline = NULL;
+			for (size_t i = filled; i > 0 && !newline; --i) {
+				if (buffer[i - 1] == '\n') {
+					newline = &buffer[i - 1];
+				}
+			}
+			if (!newline) {
+				return false;
+			}
+			end = newline - buffer.data() + 1;
+		}
+		data = buffer.data();
+		n = end;
+		consumed = end;
+		return true;
+	}
+
+	// Offset in the file of the current chunk
+	uint64_t chunk_offset() const { return offset; }
+
+private:
+	FILE *file;
+	std::vector<char> buffer;
+	size_t filled;
+	size_t consumed;
+	uint64_t offset;
+};
+
+// Cut [0, n) of data into pieces ending on line boundaries, bounds[j] to
+// bounds[j + 1] being piece j
+void split_lines(const char *data, size_t n, int pieces, std::vector<size_t> &bounds) {
+	bounds.assign(1, 0);
+	for (int j = 1; j < pieces; ++j) {
+		size_t at = std::max(bounds.back(), n * j / pieces);
+		const void *newline = at < n ? std::memchr(data + at, '\n', n - at) : NULL;
+		bounds.push_back(newline ? (const char *) newline - data + 1 : n);
+	}
+	bounds.push_back(n);
+}
+
+// Triangles parsed from a piece of a chunk
+struct Piece {
+	// 6 coordinates and 9 color components per triangle
+	std::vector<float> positions;
+	std::vector<float> colors;
+	// OBJ only: x, y, r, g, b of every vertex and the corners of the faces
+	std::vector<float> vertices;
+	std::vector<long long> corners;
+	// Offset in the piece of the first invalid line, no_error if none
+	size_t error;
+
+	void reset() {
+		positions.clear();
+		colors.clear();
+		vertices.clear();
+		corners.clear();
+		error = no_error;
+	}
+
+	int triangles() const { return (int) positions.size() / 6; }
+};
+
+void run(ThreadPool *pool, int n, const std::function<void(int, int)> &f) {
+	if (pool) {
+		pool->parallel_for(n, 1, f);
+	} else {
+		f(0, n);
+	}
+}
+
+// Append the triangles of the pieces to store in order
+void append_pieces(TriangleStore &store, const std::vector<Piece> &pieces, ThreadPool *pool,
+	const ImportBatch &batch)
+{
+	std::vector<int> first(pieces.size() + 1, store.size());
+	for (size_t j = 0; j < pieces.size(); ++j) {
+		first[j + 1] = first[j] + pieces[j].triangles();
+	}
+	int begin = first[0], count = first.back() - begin;
+	if (count == 0) {
+		return;
+	}
+	store.resize(begin + count);
+	run(pool, (int) pieces.size(), [&](int from, int to) {
+		for (int j = from; j < to; ++j) {
+			const Piece &piece = pieces[j];
+			for (int i = 0; i < piece.triangles(); ++i) {
+				int t = first[j] + i;
+				for (int v = 0; v < 3; ++v) {
+					store.positions.col(t * 3 + v) << piece.positions[i * 6 + v * 2], piece.positions[i * 6 + v * 2 + 1], 1.0f;
+					store.colors.col(t * 3 + v) = Eigen::Map<const Eigen::Vector3f>(&piece.colors[i * 9 + v * 3]);
+				}
+				store.set_state(t, TriangleStore::Normal);
+				store.reset_transform(t);
+			}
+		}
+	});
+	if (batch) {
+		batch(begin, count);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// Binary STL
+
+const size_t stl_header_bytes = 84;
+const size_t stl_record_bytes = 50;
+
+// Size of an open file in bytes, -1 on error. The position is kept. long is 32
+// bits on Windows, so the 64-bit offset functions are used for files over 2 GB.
+long long file_size(FILE *file) {
+#ifdef _WIN32
+	long long position = _ftelli64(file);
+	if (position < 0 || _fseeki64(file, 0, SEEK_END) != 0) {
+		return -1;
+	}
+	long long size = _ftelli64(file);
+	return _fseeki64(file, position, SEEK_SET) == 0 ? size : -1;
+#else
+	off_t position = ftello(file);
+	if (position < 0 || fseeko(file, 0, SEEK_END) != 0) {
+		return -1;
+	}
+	long long size = (long long) ftello(file);
+	return fseeko(file, position, SEEK_SET) == 0 ? size : -1;
+#endif
+}
+
+int import_stl(const std::string &path, FILE *file, TriangleStore &store, ThreadPool *pool,
+	const ImportBatch &batch)
+{
+	unsigned char header[stl_header_bytes];
+	uint32_t count = 0;
+	bool ok = std::fread(header, 1, stl_header_bytes, file) == stl_header_bytes;
+	if (ok) {
+		std::memcpy(&count, header + 80, sizeof(count));
+	}
+	// The facet count has to match the size of the file
+	long long size = ok ? file_size(file) : -1;
+	if (!ok || size != (long long) (stl_header_bytes + (uint64_t) count * stl_record_bytes) ||
+		count > (uint32_t) 0x7fffffff / 9 - (uint32_t) store.size())
+	{
+		std::cerr << path << ": not a binary STL file (ASCII STL is not supported)" << std::endl;
+		return -1;
+	}
+
+	// The count is known up front, so the store grows once
+	store.reserve(store.size() + (int) count);
+	std::vector<unsigned char> chunk(import_chunk_bytes / stl_record_bytes * stl_record_bytes);
+	const int per_chunk = (int) (chunk.size() / stl_record_bytes);
+	int pieces = pool ? pool->size() : 1;
+	for (uint32_t done = 0; done < count; ) {
+		int n = (int) std::min<uint32_t>(per_chunk, count - done);
+		if (std::fread(chunk.data(), stl_record_bytes, n, file) != (size_t) n) {
+			std::cerr << path << ": read error" << std::endl;
+			return -1;
+		}
+
+		// Records have a fixed size, so the facets go straight to the store
+		int first = store.size();
+		store.resize(first + n);
+		run(pool, pieces, [&](int from, int to) {
+			for (int i = (int) ((long long) n * from / pieces); i < (int) ((long long) n * to / pieces); ++i) {
+				const unsigned char *record = &chunk[i * stl_record_bytes];
+				float v[9];
+				// Skip the normal, the vertices follow it
+				std::memcpy(v, record + 12, sizeof(v));
+				int t = first + i;
+				for (int k = 0; k < 3; ++k) {
+					store.positions.col(t * 3 + k) << v[k * 3], v[k * 3 + 1], 1.0f;
+					store.colors.col(t * 3 + k) = Eigen::Map<const Eigen::Vector3f>(default_color);
+				}
+				store.set_state(t, TriangleStore::Normal);
+				store.reset_transform(t);
+			}
+		});
+		if (batch) {
+			batch(first, n);
+		}
+		done += n;
+	}
+	return (int) count;
+}
+
+// -----------------------------------------------------------------------------
+// CSV
+
+// Parse the lines of [p, end), first_line is set when the piece starts the file
+void parse_csv(const char *data, const char *end, bool first_line, Piece &piece) {
+	for (const char *p = data; p < end; ) {
+		const char *line = p;
+		const char *eol = (const char *) std::memchr(p, '\n', end - p);
+		if (!eol) {
+			eol = end;
+		}
+		p = eol + (eol < end);
+
+		const char *s = line;
+		skip_blanks(s, eol);
+		if (s == eol || *s == '#') {
+			continue;
+		}
+		float v[9];
+		int n = 0;
+		for (; n < 9; ++n) {
+			skip_blanks(s, eol);
+			if (n > 0) {
+				if (s == eol) {
+					break;
+				}
+				if (*s != ',') {
+					n = -1;
+					break;
+				}
+				++s;
+				skip_blanks(s, eol);
+			}
+			if (!parse_float(s, eol, v[n])) {
+				n = -1;
+				break;
+			}
+		}
+		skip_blanks(s, eol);
+		if ((n != 6 && n != 9) || s != eol) {
+			// A header is only allowed on the first line of the file
+			if (!(first_line && line == data)) {
+				piece.error = line - data;
+				return;
+			}
+			continue;
+		}
+		piece.positions.insert(piece.positions.end(), v, v + 6);
+		for (int k = 0; k < 3; ++k) {
+			piece.colors.insert(piece.colors.end(), n == 9 ? v + 6 : default_color, n == 9 ? v + 9 : default_color + 3);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// OBJ
+
+// Parse the v and f statements of [data, end). Corners are kept as 0-based
+// indices, relative ones are made relative to the first vertex of the piece
+// and flagged by bit 62.
+const long long relative_corner = 1LL << 62;
+
+void parse_obj(const char *data, const char *end, Piece &piece) {
+	for (const char *p = data; p < end; ) {
+		const char *line = p;
+		const char *eol = (const char *) std::memchr(p, '\n', end - p);
+		if (!eol) {
+			eol = end;
+		}
+		p = eol + (eol < end);
+
+		const char *s = line;
+		skip_blanks(s, eol);
+		if (eol - s < 2 || (s[1] != ' ' && s[1] != '\t')) {
+			continue;
+		}
+		if (s[0] == 'v') {
+			// x y z, optionally followed by r g b
+			float v[6];
+			int n = 0;
+			++s;
+			for (; n < 6; ++n) {
+				skip_blanks(s, eol);
+				if (s == eol || !parse_float(s, eol, v[n])) {
+					break;
+				}
+			}
+			skip_blanks(s, eol);
+			if (n < 2 || (s != eol && n != 6)) {
+				piece.error = line - data;
+				return;
+			}
+			const float *color = n == 6 ? v + 3 : default_color;
+			float vertex[5] = { v[0], v[1], color[0], color[1], color[2] };
+			piece.vertices.insert(piece.vertices.end(), vertex, vertex + 5);
+		} else if (s[0] == 'f') {
+			// Corners are v, v/vt, v//vn or v/vt/vn, the polygon is split into a fan
+			long long vertices = (long long) piece.vertices.size() / 5;
+			long long fan[2];
+			int n = 0;
+			for (++s; ; ++n) {
+				skip_blanks(s, eol);
+				if (s == eol) {
+					break;
+				}
+				long long index;
+				if (!parse_int(s, eol, index) || index == 0) {
+					piece.error = line - data;
+					return;
+				}
+				while (s < eol && *s != ' ' && *s != '\t' && *s != '\r') {
+					++s;
+				}
+				long long corner = index > 0 ? index - 1 : relative_corner + vertices + index;
+				if (n < 2) {
+					fan[n] = corner;
+				} else {
+					piece.corners.push_back(fan[0]);
+					piece.corners.push_back(fan[1]);
+					piece.corners.push_back(corner);
+					fan[1] = corner;
+				}
+			}
+			if (n < 3) {
+				piece.error = line - data;
+				return;
+			}
+		}
+	}
+}
+
+int import_text(const std::string &path, FILE *file, Format format, TriangleStore &store, ThreadPool *pool,
+	const ImportBatch &batch)
+{
+	LineChunks chunks(file, import_chunk_bytes);
+	std::vector<Piece> pieces(pool ? pool->size() : 1);
+	std::vector<size_t> bounds;
+	// x, y, r, g, b of the OBJ vertices read so far
+	std::vector<float> vertices;
+	int imported = 0;
+
+	const char *data;
+	size_t n;
+	for (;;) {
+		if (!chunks.next(data, n)) {
+			std::cerr << path << ": read error or line longer than " << import_chunk_bytes << " bytes" << std::endl;
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		split_lines(data, n, (int) pieces.size(), bounds);
+		bool first_chunk = chunks.chunk_offset() == 0;
+		run(pool, (int) pieces.size(), [&](int from, int to) {
+			for (int j = from; j < to; ++j) {
+				pieces[j].reset();
+				if (format == CSV) {
+					parse_csv(data + bounds[j], data + bounds[j + 1], first_chunk && j == 0, pieces[j]);
+				} else {
+					parse_obj(data + bounds[j], data + bounds[j + 1], pieces[j]);
+				}
+			}
+		});
+		for (size_t j = 0; j < pieces.size(); ++j) {
+			if (pieces[j].error != no_error) {
+				std::cerr << path << ": invalid line at byte " << chunks.chunk_offset() + bounds[j] + pieces[j].error
+					<< std::endl;
+				return -1;
+			}
+		}
+
+		if (format == OBJ) {
+			// Gather the vertices in file order, then resolve the corners of
+			// every piece against them
+			std::vector<long long> base(pieces.size());
+			for (size_t j = 0; j < pieces.size(); ++j) {
+				base[j] = (long long) vertices.size() / 5;
+				vertices.insert(vertices.end(), pieces[j].vertices.begin(), pieces[j].vertices.end());
+			}
+			const long long total = (long long) vertices.size() / 5;
+			std::vector<char> invalid(pieces.size(), 0);
+			run(pool, (int) pieces.size(), [&](int from, int to) {
+				for (int j = from; j < to; ++j) {
+					Piece &piece = pieces[j];
+					for (size_t c = 0; c < piece.corners.size(); ++c) {
+						long long v = piece.corners[c];
+						if (v >= relative_corner / 2) {
+							v = v - relative_corner + base[j];
+						}
+						if (v < 0 || v >= total) {
+							invalid[j] = 1;
+							break;
+						}
+						const float *vertex = &vertices[v * 5];
+						piece.positions.insert(piece.positions.end(), vertex, vertex + 2);
+						piece.colors.insert(piece.colors.end(), vertex + 2, vertex + 5);
+					}
+				}
+			});
+			if (std::count(invalid.begin(), invalid.end(), 1) > 0) {
+				std::cerr << path << ": face with an undefined vertex" << std::endl;
+				return -1;
+			}
+		}
+
+		int count = 0;
+		for (size_t j = 0; j < pieces.size(); ++j) {
+			count += pieces[j].triangles();
+		}
+		if (count > 0x7fffffff / 9 - store.size()) {
+			std::cerr << path << ": too many triangles" << std::endl;
+			return -1;
+		}
+		append_pieces(store, pieces, pool, batch);
+		imported += count;
+	}
+	return imported;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool importable(const std::string &path) {
+	return format_of(path) != Unknown;
+}
+
+int import_triangles(const std::string &path, TriangleStore &store, ThreadPool *pool, const ImportBatch &batch) {
+	Format format = format_of(path);
+	if (format == Unknown) {
+		std::cerr << path << ": unknown format, expected .stl, .obj or .csv" << std::endl;
+		return -1;
+	}
+	FILE *file = std::fopen(path.c_str(), "rb");
+	if (!file) {
+		std::cerr << path << ": cannot open the file" << std::endl;
+		return -1;
+	}
+	int imported = format == STL ? import_stl(path, file, store, pool, batch)
+		: import_text(path, file, format, store, pool, batch);
+	std::fclose(file);
+	return imported;
+}
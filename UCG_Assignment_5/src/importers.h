@@ -0,0 +1,37 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "thread_pool.h"
+#include <functional>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+// Import of triangle soups written by other tools.
+//
+//   .stl   binary STL, the facets are projected onto the xy plane
+//   .obj   v and f statements (polygons are split into fans, v may carry an
+//          r g b color after x y z), everything else is ignored
+//   .csv   one triangle per line: x0,y0,x1,y1,x2,y2[,r,g,b] (a header line
+//          and lines starting with # are skipped)
+//
+// Files are read by chunks of import_chunk_bytes. A chunk is cut at record
+// boundaries into one piece per thread, the pieces are parsed in parallel
+// and their triangles appended to the store in file order, so that memory
+// stays bounded by the chunk size (plus the vertices of an OBJ file) whatever
+// the size of the file. Numbers are parsed by hand, without streams or
+// locales.
+
+const size_t import_chunk_bytes = 16 << 20;
+
+// Called after every batch of triangles [first, first + count) is appended
+typedef std::function<void(int first, int count)> ImportBatch;
+
+// Whether path has the extension of a supported format
+bool importable(const std::string &path);
+
+// Append the triangles of the file at path to store. Reports problems on
+// std::cerr and returns the number of triangles imported, -1 on error (the
+// triangles of the batches already reported are kept).
+int import_triangles(const std::string &path, TriangleStore &store, ThreadPool *pool = 0,
+	const ImportBatch &batch = ImportBatch());
@@ -0,0 +1,246 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "input_log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const char magic[8] = { 'U', 'C', 'G', 'I', 'N', 'P', 'U', 'T' };
+const int32_t version = 1;
+
+// Bytes of the arguments of each kind of event
+const size_t argument_bytes[] = { 8, 3, 16, 16 };
+
+// Flush the recorder buffer past this size
+const size_t buffer_bytes = 64 << 10;
+
+template <typename T>
+void put(std::vector<unsigned char> &out, T value) {
+	unsigned char bytes[sizeof(T)];
+	std::memcpy(bytes, &value, sizeof(T));
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+T get(const unsigned char *&p) {
+	T value;
+	std::memcpy(&value, p, sizeof(T));
+	p += sizeof(T);
+	return value;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool InputRecorder::open(const std::string &path, const int window[2], const int framebuffer[2]) {
+	close();
+	this->path = path;
+	file = std::fopen(path.c_str(), "wb");
+	if (!file) {
+		std::cerr << path << ": cannot write the input log" << std::endl;
+		return false;
+	}
+	failed = false;
+	buffer.assign(magic, magic + sizeof(magic));
+	put<int32_t>(buffer, version);
+	put<int32_t>(buffer, window[0]);
+	put<int32_t>(buffer, window[1]);
+	put<int32_t>(buffer, framebuffer[0]);
+	put<int32_t>(buffer, framebuffer[1]);
+	return true;
+}
+
+void InputRecorder::record(const InputEvent &e) {
+	if (!file) {
+		return;
+	}
+	put<uint8_t>(buffer, (uint8_t) e.kind);
+	put<double>(buffer, e.time);
+	switch (e.kind) {
+	case InputEvent::Key:
+		put<int16_t>(buffer, (int16_t) e.args[0]);
+		put<int32_t>(buffer, e.args[1]);
+		put<uint8_t>(buffer, (uint8_t) e.args[2]);
+		put<uint8_t>(buffer, (uint8_t) e.args[3]);
+		break;
+	case InputEvent::MouseButton:
+		put<uint8_t>(buffer, (uint8_t) e.args[0]);
+		put<uint8_t>(buffer, (uint8_t) e.args[1]);
+		put<uint8_t>(buffer, (uint8_t) e.args[2]);
+		break;
+	case InputEvent::CursorPos:
+		put<double>(buffer, e.x);
+		put<double>(buffer, e.y);
+		break;
+	case InputEvent::Resize:
+		for (int i = 0; i < 4; ++i) {
+			put<int32_t>(buffer, e.args[i]);
+		}
+		break;
+	}
+	if (buffer.size() >= buffer_bytes) {
+		write_buffer();
+	}
+}
+
+bool InputRecorder::close() {
+	if (!file) {
+		return true;
+	}
+	write_buffer();
+	failed = std::fclose(file) != 0 || failed;
+	file = NULL;
+	if (failed) {
+		std::cerr << path << ": cannot write the input log" << std::endl;
+	}
+	return !failed;
+}
+
+void InputRecorder::write_buffer() {
+	failed = std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size() || failed;
+	buffer.clear();
+}
+
+bool load_input_log(const std::string &path, InputLog &log) {
+	FILE *file = std::fopen(path.c_str(), "rb");
+	if (!file) {
+		std::cerr << path << ": cannot open the input log" << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> data;
+	unsigned char chunk[1 << 16];
+	for (size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) > 0; ) {
+		data.insert(data.end(), chunk, chunk + n);
+	}
+	bool read_error = std::ferror(file) != 0;
+	std::fclose(file);
+	if (read_error) {
+		std::cerr << path << ": cannot read the input log" << std::endl;
+		return false;
+	}
+
+	const size_t header_bytes = sizeof(magic) + 5 * sizeof(int32_t);
+	const unsigned char *p = data.data(), *end = p + data.size();
+	if (data.size() < header_bytes || std::memcmp(p, magic, sizeof(magic)) != 0) {
+		std::cerr << path << ": not an input log" << std::endl;
+		return false;
+	}
+	p += sizeof(magic);
+	if (get<int32_t>(p) != version) {
+		std::cerr << path << ": unsupported input log version" << std::endl;
+		return false;
+	}
+	log.window[0] = get<int32_t>(p);
+	log.window[1] = get<int32_t>(p);
+	log.framebuffer[0] = get<int32_t>(p);
+	log.framebuffer[1] = get<int32_t>(p);
+
+	log.events.clear();
+	while (p < end) {
+		InputEvent e = InputEvent();
+		uint8_t kind = *p++;
+		if (kind > InputEvent::Resize || (size_t) (end - p) < sizeof(double) + argument_bytes[kind]) {
+			std::cerr << path << ": invalid event " << log.events.size() << std::endl;
+			return false;
+		}
+		e.kind = (InputEvent::Kind) kind;
+		e.time = get<double>(p);
+		switch (e.kind) {
+		case InputEvent::Key:
+			e.args[0] = get<int16_t>(p);
+			e.args[1] = get<int32_t>(p);
+			e.args[2] = get<uint8_t>(p);
+			e.args[3] = get<uint8_t>(p);
+			break;
+		case InputEvent::MouseButton:
+			e.args[0] = get<uint8_t>(p);
+			e.args[1] = get<uint8_t>(p);
+			e.args[2] = get<uint8_t>(p);
+			break;
+		case InputEvent::CursorPos:
+			e.x = get<double>(p);
+			e.y = get<double>(p);
+			break;
+		case InputEvent::Resize:
+			for (int i = 0; i < 4; ++i) {
+				e.args[i] = get<int32_t>(p);
+			}
+			break;
+		}
+		log.events.push_back(e);
+	}
+	return true;
+}
+
+const char *input_kind_name(InputEvent::Kind kind) {
+	switch (kind) {
+	case InputEvent::Key: return "key";
+	case InputEvent::MouseButton: return "mouse_button";
+	case InputEvent::CursorPos: return "cursor_pos";
+	case InputEvent::Resize: return "resize";
+	}
+	return "unknown";
+}
+
+void print_input_latency(const InputLog &log, const std::vector<double> &latency) {
+	std::printf("%-13s %8s %10s %10s %10s %10s %10s\n", "event", "count", "mean (ms)", "p50", "p95", "p99", "max");
+	for (int k = InputEvent::Key; k <= InputEvent::Resize; ++k) {
+		std::vector<double> times;
+		double sum = 0;
+		for (size_t i = 0; i < log.events.size(); ++i) {
+			if (log.events[i].kind == k) {
+				times.push_back(latency[i] * 1e3);
+				sum += latency[i] * 1e3;
+			}
+		}
+		if (times.empty()) {
+			continue;
+		}
+		std::sort(times.begin(), times.end());
+		// Nearest rank
+		double p[3];
+		const double percentiles[3] = { 0.50, 0.95, 0.99 };
+		for (int j = 0; j < 3; ++j) {
+			size_t rank = (size_t) std::ceil(percentiles[j] * times.size());
+			p[j] = times[std::max<size_t>(rank, 1) - 1];
+		}
+		std::printf("%-13s %8zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", input_kind_name((InputEvent::Kind) k),
+			times.size(), sum / times.size(), p[0], p[1], p[2], times.back());
+	}
+
+	const size_t slowest = std::min<size_t>(5, latency.size());
+	std::vector<size_t> order(latency.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::partial_sort(order.begin(), order.begin() + slowest, order.end(),
+		[&](size_t a, size_t b) { return latency[a] > latency[b]; });
+	for (size_t i = 0; i < slowest; ++i) {
+		const InputEvent &e = log.events[order[i]];
+		std::printf("slowest: event %zu (%s at %.3f s) took %.3f ms\n", order[i], input_kind_name(e.kind), e.time,
+			latency[order[i]] * 1e3);
+	}
+}
+
+bool write_input_latency(const std::string &path, const InputLog &log, const std::vector<double> &latency) {
+	FILE *file = std::fopen(path.c_str(), "w");
+	if (!file) {
+		std::cerr << path << ": cannot write the latencies" << std::endl;
+		return false;
+	}
+	std::fprintf(file, "event,time,kind,latency_us\n");
+	for (size_t i = 0; i < log.events.size(); ++i) {
+		std::fprintf(file, "%zu,%.6f,%s,%.3f\n", i, log.events[i].time, input_kind_name(log.events[i].kind),
+			latency[i] * 1e6);
+	}
+	if (std::fclose(file) != 0) {
+		std::cerr << path << ": cannot write the latencies" << std::endl;
+		return false;
+	}
+	return true;
+}
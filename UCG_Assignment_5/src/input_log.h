@@ -0,0 +1,78 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstdio>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Recording of the input of an editing session, to replay it later.
+//
+// A log starts with the magic "UCGINPUT", a version and the window and
+// framebuffer sizes at the start of the session, followed by one variable
+// size record per event: a kind byte, the time as a double and the
+// arguments of the callback (8 bytes for a key, 3 for a mouse button, 16 for
+// a cursor position or a resize). Numbers are stored in the byte order of
+// the machine.
+
+struct InputEvent {
+	enum Kind {
+		Key = 0,
+		MouseButton = 1,
+		CursorPos = 2,
+		Resize = 3,
+	};
+
+	Kind kind;
+	// Seconds since the start of the recording
+	double time;
+	// Key: key, scancode, action, mods. MouseButton: button, action, mods.
+	// Resize: window width and height, framebuffer width and height.
+	int args[4];
+	// CursorPos: position in screen coordinates
+	double x;
+	double y;
+};
+
+struct InputLog {
+	// Window and framebuffer sizes when the recording started
+	int window[2];
+	int framebuffer[2];
+	std::vector<InputEvent> events;
+};
+
+// Writes events to a log as they happen, through a buffer
+class InputRecorder {
+public:
+	InputRecorder() : file(NULL) { }
+	~InputRecorder() { close(); }
+
+	bool is_open() const { return file != NULL; }
+
+	bool open(const std::string &path, const int window[2], const int framebuffer[2]);
+	void record(const InputEvent &e);
+
+	// Write the buffered events, returns false if any write failed
+	bool close();
+
+private:
+	std::string path;
+	FILE *file;
+	std::vector<unsigned char> buffer;
+	bool failed;
+
+	void write_buffer();
+};
+
+// Read a whole log, reports problems on std::cerr
+bool load_input_log(const std::string &path, InputLog &log);
+
+// Name of an event kind, for the reports
+const char *input_kind_name(InputEvent::Kind kind);
+
+// Print the percentiles of the time taken to handle each kind of event, in
+// seconds in latency (one per event of log), and the slowest events
+void print_input_latency(const InputLog &log, const std::vector<double> &latency);
+
+// One CSV line per event: index, time, kind, latency in microseconds
+bool write_input_latency(const std::string &path, const InputLog &log, const std::vector<double> &latency);
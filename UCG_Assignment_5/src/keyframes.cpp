@@ -0,0 +1,584 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "keyframes.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const float two_pi = 6.28318531f;
+
+// Number of objects evaluated by one call to the curve kernel, a multiple of
+// the widest vector
+const int block_size = 64;
+
+// Evaluated components of an object (position x, position y, rotation, scale)
+// and the channel each of them belongs to
+const int components = 4;
+const int component_channel[components] = { 0, 0, 1, 2 };
+
+// Evaluate the cubic Bezier curves of n objects of a block (n multiple of 8).
+// u holds the curve parameter of every channel and lane, p the four control
+// points of every component and lane, out receives every component.
+typedef void (*CurveKernel)(const float *u, const float *p, float *out, int n);
+
+// Index of control point k of component j for lane 0 of a block
+inline int cp(int j, int k) {
+	return (j * 4 + k) * block_size;
+}
+
+void curves_scalar(const float *u, const float *p, float *out, int n) {
+	for (int j = 0; j < components; ++j) {
+		const float *uj = u + component_channel[j] * block_size;
+		for (int i = 0; i < n; ++i) {
+			float t = uj[i], s = 1 - t;
+			out[j * block_size + i] = s * s * s * p[cp(j, 0) + i] + 3 * t * s * s * p[cp(j, 1) + i] +
+				3 * t * t * s * p[cp(j, 2) + i] + t * t * t * p[cp(j, 3) + i];
+		}
+	}
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse2")
+void curves_sse2(const float *u, const float *p, float *out, int n) {
+	const __m128 one = _mm_set1_ps(1.0f), three = _mm_set1_ps(3.0f);
+	for (int j = 0; j < components; ++j) {
+		const float *uj = u + component_channel[j] * block_size;
+		for (int i = 0; i < n; i += 4) {
+			__m128 t = _mm_load_ps(uj + i), s = _mm_sub_ps(one, t);
+			__m128 ts = _mm_mul_ps(_mm_mul_ps(three, t), s);
+			__m128 b0 = _mm_mul_ps(_mm_mul_ps(s, s), s);
+			__m128 b1 = _mm_mul_ps(ts, s);
+			__m128 b2 = _mm_mul_ps(ts, t);
+			__m128 b3 = _mm_mul_ps(_mm_mul_ps(t, t), t);
+			__m128 r = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(b0, _mm_load_ps(p + cp(j, 0) + i)), _mm_mul_ps(b1, _mm_load_ps(p + cp(j, 1) + i))),
+				_mm_add_ps(_mm_mul_ps(b2, _mm_load_ps(p + cp(j, 2) + i)), _mm_mul_ps(b3, _mm_load_ps(p + cp(j, 3) + i))));
+			_mm_store_ps(out + j * block_size + i, r);
+		}
+	}
+}
+
+SIMD_TARGET("avx2")
+void curves_avx2(const float *u, const float *p, float *out, int n) {
+	const __m256 one = _mm256_set1_ps(1.0f), three = _mm256_set1_ps(3.0f);
+	for (int j = 0; j < components; ++j) {
+		const float *uj = u + component_channel[j] * block_size;
+		for (int i = 0; i < n; i += 8) {
+			__m256 t = _mm256_load_ps(uj + i), s = _mm256_sub_ps(one, t);
+			__m256 ts = _mm256_mul_ps(_mm256_mul_ps(three, t), s);
+			__m256 b0 = _mm256_mul_ps(_mm256_mul_ps(s, s), s);
+			__m256 b1 = _mm256_mul_ps(ts, s);
+			__m256 b2 = _mm256_mul_ps(ts, t);
+			__m256 b3 = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+			__m256 r = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(b0, _mm256_load_ps(p + cp(j, 0) + i)), _mm256_mul_ps(b1, _mm256_load_ps(p + cp(j, 1) + i))),
+				_mm256_add_ps(_mm256_mul_ps(b2, _mm256_load_ps(p + cp(j, 2) + i)), _mm256_mul_ps(b3, _mm256_load_ps(p + cp(j, 3) + i))));
+			_mm256_store_ps(out + j * block_size + i, r);
+		}
+	}
+}
+
+#endif // SIMD_X86
+
+CurveKernel curve_kernel(SimdLevel k) {
+	switch (k) {
+#ifdef SIMD_X86
+		case SimdSSE2: return curves_sse2;
+		case SimdAVX2: return curves_avx2;
+#endif
+		default: return curves_scalar;
+	}
+}
+
+// Kernel in use, detected on the first call
+SimdLevel &active_kernel() {
+	static SimdLevel k = simd_best();
+	return k;
+}
+
+CurveKernel &active_curves() {
+	static CurveKernel f = curve_kernel(active_kernel());
+	return f;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+int KeyframeStore::find(int t) const {
+	std::unordered_map<int, int>::const_iterator it = by_triangle.find(t);
+	return it == by_triangle.end() ? -1 : it->second;
+}
+
+int KeyframeStore::add(const TriangleStore &store, int t) {
+	Eigen::Vector2f c = store.barycenter(t);
+	float pose[8] = { c[0], c[1] };
+	for (int v = 0; v < 3; ++v) {
+		pose[2 + v * 2] = store.positions(0, t * 3 + v) - c[0];
+		pose[3 + v * 2] = store.positions(1, t * 3 + v) - c[1];
+	}
+	return add(t, pose);
+}
+
+int KeyframeStore::add(int t, const float *rest_pose) {
+	int o = find(t);
+	if (o != -1) {
+		return o;
+	}
+	o = size();
+	objects.push_back(t);
+	by_triangle[t] = o;
+	rest.insert(rest.end(), rest_pose, rest_pose + 8);
+
+	for (int ch = 0; ch < channels; ++ch) {
+		Track tr = { (int) times[ch].size(), 0, 0, ++edits };
+		tracks.push_back(tr);
+	}
+	return o;
+}
+
+void KeyframeStore::key(int o, float time, const TriangleStore &store) {
+	int t = objects[o];
+	const float *r = &rest[o * 8 + 2];
+	Eigen::Vector2f c = store.barycenter(t);
+
+	// Rotation and scale that best map the rest vertices onto the current ones
+	// (exact for the rigid motions and uniform scalings of the editor)
+	float dot = 0, cross = 0, norm = 0;
+	for (int v = 0; v < 3; ++v) {
+		float nx = store.positions(0, t * 3 + v) - c[0];
+		float ny = store.positions(1, t * 3 + v) - c[1];
+		dot += r[v * 2] * nx + r[v * 2 + 1] * ny;
+		cross += r[v * 2] * ny - r[v * 2 + 1] * nx;
+		norm += r[v * 2] * r[v * 2] + r[v * 2 + 1] * r[v * 2 + 1];
+	}
+	float angle = 0, scale = 1;
+	if (norm > 0) {
+		angle = std::atan2(cross, dot);
+		scale = std::sqrt(dot * dot + cross * cross) / norm;
+	}
+
+	// Take the turn closest to the previous key so that the rotation goes the
+	// short way instead of spinning back across -pi / pi
+	const Track &rot = tracks[o * channels + Rotation];
+	if (rot.count > 0) {
+		const float *kt = &times[Rotation][rot.first];
+		int prev = std::max(0, (int) (std::upper_bound(kt, kt + rot.count, time) - kt) - 1);
+		float previous = values[Rotation][rot.first + prev];
+		angle += two_pi * std::floor((previous - angle) / two_pi + 0.5f);
+	}
+
+	set_key(o, Position, time, c.data());
+	set_key(o, Rotation, time, &angle);
+	set_key(o, Scale, time, &scale);
+}
+
+int KeyframeStore::set_key(int o, Channel c, float time, const float *value) {
+	assert(o >= 0 && o < size());
+	Track &tr = tracks[o * channels + c];
+	int w = width(c);
+	std::vector<float> &kt = times[c];
+
+	int i = (int) (std::lower_bound(kt.begin() + tr.first, kt.begin() + tr.first + tr.count, time) - kt.begin());
+	if (i < tr.first + tr.count && kt[i] == time) {
+		std::copy(value, value + w, values[c].begin() + i * w);
+	} else {
+		unsigned char mode = i > tr.first ? modes[c][i - 1] : (unsigned char) Linear;
+		kt.insert(kt.begin() + i, time);
+		values[c].insert(values[c].begin() + i * w, value, value + w);
+		tangents_in[c].insert(tangents_in[c].begin() + i * w, w, 0.0f);
+		tangents_out[c].insert(tangents_out[c].begin() + i * w, w, 0.0f);
+		modes[c].insert(modes[c].begin() + i, mode);
+		++tr.count;
+
+		// The keys of the following objects moved by one
+		for (int next = o + 1; next < size(); ++next) {
+			++tracks[next * channels + c].first;
+		}
+	}
+	update_tangents(tr, c, i - tr.first);
+	tr.revision = ++edits;
+	return i - tr.first;
+}
+
+void KeyframeStore::set_tangents(int o, Channel c, int k, const float *in, const float *out) {
+	const Track &tr = tracks[o * channels + c];
+	assert(k >= 0 && k < tr.count);
+	int w = width(c), i = tr.first + k;
+	std::copy(in, in + w, tangents_in[c].begin() + i * w);
+	std::copy(out, out + w, tangents_out[c].begin() + i * w);
+	modes[c][i] = Bezier;
+	tracks[o * channels + c].revision = ++edits;
+}
+
+void KeyframeStore::set_interpolation(Interpolation mode) {
+	for (size_t i = 0; i < tracks.size(); ++i) {
+		Track &tr = tracks[i];
+		Channel c = (Channel) (i % channels);
+		unsigned char *m = modes[c].empty() ? NULL : &modes[c][tr.first];
+		// Tracks already in this mode keep their revision (and their bake)
+		if (tr.count == 0 || std::count(m, m + tr.count, (unsigned char) mode) == tr.count) {
+			continue;
+		}
+		std::fill(m, m + tr.count, (unsigned char) mode);
+		for (int k = 0; k < tr.count; k += 2) {
+			update_tangents(tr, c, k);
+		}
+		tr.revision = ++edits;
+	}
+}
+
+void KeyframeStore::set_interpolation(int o, Channel c, int k, Interpolation mode) {
+	Track &tr = tracks[o * channels + c];
+	assert(k >= 0 && k < tr.count);
+	modes[c][tr.first + k] = (unsigned char) mode;
+	update_tangents(tr, c, k);
+	tr.revision = ++edits;
+}
+
+void KeyframeStore::update_tangents(const Track &tr, Channel c, int k) {
+	int w = width(c);
+	for (int j = std::max(0, k - 1); j <= std::min(tr.count - 1, k + 1); ++j) {
+		int i = tr.first + j;
+		if (modes[c][i] != CatmullRom) {
+			continue;
+		}
+		// Slope between the neighbours, one-sided at both ends of the track
+		int prev = tr.first + std::max(0, j - 1);
+		int next = tr.first + std::min(tr.count - 1, j + 1);
+		float dt = times[c][next] - times[c][prev];
+		for (int d = 0; d < w; ++d) {
+			float m = dt > 0 ? (values[c][next * w + d] - values[c][prev * w + d]) / dt : 0.0f;
+			tangents_in[c][i * w + d] = m;
+			tangents_out[c][i * w + d] = m;
+		}
+	}
+}
+
+float KeyframeStore::end_time() const {
+	float end = 0;
+	for (size_t i = 0; i < tracks.size(); ++i) {
+		if (tracks[i].count > 0) {
+			end = std::max(end, times[i % channels][tracks[i].first + tracks[i].count - 1]);
+		}
+	}
+	return end;
+}
+
+float KeyframeStore::end_time(int o) const {
+	float end = 0;
+	for (int ch = 0; ch < channels; ++ch) {
+		const Track &tr = tracks[o * channels + ch];
+		if (tr.count > 0) {
+			end = std::max(end, times[ch][tr.first + tr.count - 1]);
+		}
+	}
+	return end;
+}
+
+int KeyframeStore::segment(Track &tr, const float *t, float time) const {
+	int last = tr.count - 2;
+	if (last <= 0) {
+		return 0;
+	}
+	int c = std::min(tr.cursor, last);
+	if (t[c] <= time) {
+		// Playback moves forward, try the cached segment and the next one
+		if (c == last || time < t[c + 1]) {
+			return c;
+		}
+		if (c + 1 == last || time < t[c + 2]) {
+			return tr.cursor = c + 1;
+		}
+	}
+	c = (int) (std::upper_bound(t, t + tr.count, time) - t) - 1;
+	return tr.cursor = std::max(0, std::min(c, last));
+}
+
+float KeyframeStore::control_points(Track &tr, Channel c, float time, float *p) const {
+	int w = width(c);
+	const float *v = &values[c][tr.first * w];
+	if (tr.count == 1) {
+		for (int k = 0; k < 4; ++k) {
+			std::copy(v, v + w, p + k * w);
+		}
+		return 0;
+	}
+
+	const float *t = &times[c][tr.first];
+	int i = segment(tr, t, time);
+	float span = t[i + 1] - t[i];
+	float u = span > 0 ? std::min(std::max((time - t[i]) / span, 0.0f), 1.0f) : 1.0f;
+
+	const float *v0 = v + i * w, *v1 = v + (i + 1) * w;
+	const float *out = &tangents_out[c][(tr.first + i) * w];
+	const float *in = &tangents_in[c][(tr.first + i + 1) * w];
+	bool linear = modes[c][tr.first + i] == Linear;
+	for (int d = 0; d < w; ++d) {
+		p[d] = v0[d];
+		p[3 * w + d] = v1[d];
+		if (linear) {
+			p[w + d] = v0[d] + (v1[d] - v0[d]) / 3;
+			p[2 * w + d] = v0[d] + (v1[d] - v0[d]) * 2 / 3;
+		} else {
+			// Tangents are per second, the curve parameter spans the segment
+			p[w + d] = v0[d] + out[d] * span / 3;
+			p[2 * w + d] = v1[d] - in[d] * span / 3;
+		}
+	}
+	return u;
+}
+
+void KeyframeStore::evaluate_block(int first, int n, float time, Affine *poses) {
+	alignas(32) float u[channels * block_size];
+	alignas(32) float p[components * 4 * block_size];
+	alignas(32) float out[components * block_size];
+
+	// Gather the segment of every track, then evaluate all the curves at once
+	for (int i = 0; i < n; ++i) {
+		int o = first + i;
+		const float *r = &rest[o * 8];
+		const float defaults[components] = { r[0], r[1], 0.0f, 1.0f };
+		int j = 0;
+		for (int ch = 0; ch < channels; ++ch) {
+			Track &tr = tracks[o * channels + ch];
+			int w = width((Channel) ch);
+			float points[8];
+			if (tr.count == 0) {
+				u[ch * block_size + i] = 0;
+				for (int d = 0; d < w; ++d) {
+					for (int k = 0; k < 4; ++k) {
+						points[k * w + d] = defaults[j + d];
+					}
+				}
+			} else {
+				u[ch * block_size + i] = control_points(tr, (Channel) ch, time, points);
+			}
+			for (int d = 0; d < w; ++d, ++j) {
+				for (int k = 0; k < 4; ++k) {
+					p[cp(j, k) + i] = points[k * w + d];
+				}
+			}
+		}
+	}
+	// Pad to the widest vector with harmless lanes
+	int padded = (n + 7) & ~7;
+	for (int i = n; i < padded; ++i) {
+		for (int ch = 0; ch < channels; ++ch) {
+			u[ch * block_size + i] = 0;
+		}
+		for (int j = 0; j < components; ++j) {
+			for (int k = 0; k < 4; ++k) {
+				p[cp(j, k) + i] = 0;
+			}
+		}
+	}
+
+	active_curves()(u, p, out, padded);
+
+	for (int i = 0; i < n; ++i) {
+		Eigen::Vector2f position(out[0 * block_size + i], out[1 * block_size + i]);
+		poses[i] = pose(first + i, position, out[2 * block_size + i], out[3 * block_size + i]);
+	}
+}
+
+void KeyframeStore::evaluate(float time, std::vector<Affine> &poses, ThreadPool *pool) {
+	poses.resize(size());
+	std::function<void(int, int)> run = [&](int begin, int end) {
+		for (int o = begin; o < end; o += block_size) {
+			evaluate_block(o, std::min(block_size, end - o), time, &poses[o]);
+		}
+	};
+	if (pool) {
+		pool->parallel_for(size(), 1024, run);
+	} else {
+		run(0, size());
+	}
+}
+
+void KeyframeStore::sample(int o, Channel c, float t0, float dt, int n, float *out) {
+	Track &tr = tracks[o * channels + c];
+	int w = width(c);
+	if (tr.count == 0) {
+		const float *r = &rest[o * 8];
+		for (int s = 0; s < n; ++s) {
+			for (int d = 0; d < w; ++d) {
+				out[s * w + d] = c == Position ? r[d] : (c == Rotation ? 0.0f : 1.0f);
+			}
+		}
+		return;
+	}
+
+	const float *t = &times[c][tr.first];
+	for (int s = 0; s < n; ) {
+		float time = t0 + s * dt;
+		float p[8];
+		float u = control_points(tr, c, time, p);
+		int i = tr.count > 1 ? segment(tr, t, time) : 0;
+
+		// Samples left in this segment, the ones outside the keys are clamped
+		// and evaluated one by one
+		int m = 1;
+		if (tr.count > 1 && dt > 0 && time >= t[i] && time < t[i + 1]) {
+			m = std::max(1, std::min(n - s, (int) std::ceil((t[i + 1] - time) / dt)));
+		}
+
+		double h = tr.count > 1 ? dt / (t[i + 1] - t[i]) : 0;
+		for (int d = 0; d < w; ++d) {
+			// Power basis of the Bezier curve, then its forward differences at u
+			double p0 = p[d], p1 = p[w + d], p2 = p[2 * w + d], p3 = p[3 * w + d];
+			double a = p3 - p0 + 3 * (p1 - p2);
+			double b = 3 * (p0 - 2 * p1 + p2);
+			double cc = 3 * (p1 - p0);
+			double f = ((a * u + b) * u + cc) * u + p0;
+			double d1 = a * (3 * u * u * h + 3 * u * h * h + h * h * h) + b * (2 * u * h + h * h) + cc * h;
+			double d2 = a * (6 * u * h * h + 6 * h * h * h) + 2 * b * h * h;
+			double d3 = 6 * a * h * h * h;
+			for (int k = 0; k < m; ++k) {
+				out[(s + k) * w + d] = (float) f;
+				f += d1;
+				d1 += d2;
+				d2 += d3;
+			}
+		}
+		s += m;
+	}
+}
+
+KeyframeStore::Affine KeyframeStore::vertices(int o, const Affine &pose) const {
+	const float *r = &rest[o * 8];
+	Affine v;
+	for (int k = 0; k < 3; ++k) {
+		Eigen::Vector2f p(r[0] + r[2 + k * 2], r[1] + r[3 + k * 2]);
+		v.col(k) = pose.leftCols<2>() * p + pose.col(2);
+	}
+	return v;
+}
+
+KeyframeStore::Affine KeyframeStore::pose(int o, const Eigen::Vector2f &position, float angle, float scale) const {
+	// Rotate and scale about the rest barycenter, then move it to position
+	const float *r = &rest[o * 8];
+	float cs = scale * std::cos(angle), sn = scale * std::sin(angle);
+	Affine m;
+	m << cs, -sn, 0, sn, cs, 0;
+	m.col(2) = position - m.leftCols<2>() * Eigen::Vector2f(r[0], r[1]);
+	return m;
+}
+
+void KeyframeStore::save(int o, std::vector<float> &out) const {
+	// Rest pose, then per channel the number of keys followed by the time,
+	// interpolation, value and tangents of each key
+	out.insert(out.end(), rest.begin() + o * 8, rest.begin() + (o + 1) * 8);
+	for (int ch = 0; ch < channels; ++ch) {
+		Channel c = (Channel) ch;
+		int w = width(c);
+		out.push_back((float) keys(o, c));
+		for (int k = 0; k < keys(o, c); ++k) {
+			out.push_back(key_time(o, c, k));
+			out.push_back((float) key_interpolation(o, c, k));
+			out.insert(out.end(), key_value(o, c, k), key_value(o, c, k) + w);
+			out.insert(out.end(), key_tangent_in(o, c, k), key_tangent_in(o, c, k) + w);
+			out.insert(out.end(), key_tangent_out(o, c, k), key_tangent_out(o, c, k) + w);
+		}
+	}
+}
+
+int KeyframeStore::restore(int t, const float *saved) {
+	int o = add(t, saved);
+	const float *p = saved + 8;
+	for (int ch = 0; ch < channels; ++ch) {
+		Channel c = (Channel) ch;
+		int w = width(c);
+		int n = (int) *p++;
+		for (int k = 0; k < n; ++k) {
+			set_key(o, c, p[k * (2 + 3 * w)], p + k * (2 + 3 * w) + 2);
+		}
+		// The keys came sorted, copy their interpolation and tangents as they
+		// were instead of deriving them again
+		for (int k = 0; k < n; ++k, p += 2 + 3 * w) {
+			int i = key_index(o, c, k);
+			modes[c][i] = (unsigned char) p[1];
+			std::copy(p + 2 + w, p + 2 + 2 * w, tangents_in[c].begin() + i * w);
+			std::copy(p + 2 + 2 * w, p + 2 + 3 * w, tangents_out[c].begin() + i * w);
+		}
+	}
+	return o;
+}
+
+void KeyframeStore::insert_triangle(int t) {
+	for (int o = 0; o < size(); ++o) {
+		if (objects[o] >= t) {
+			++objects[o];
+		}
+	}
+	reindex();
+}
+
+void KeyframeStore::erase_triangle(int t) {
+	int o = find(t);
+	if (o != -1) {
+		drop(o);
+	}
+	for (int i = 0; i < size(); ++i) {
+		if (objects[i] > t) {
+			--objects[i];
+		}
+	}
+	reindex();
+}
+
+void KeyframeStore::drop(int o) {
+	for (int ch = 0; ch < channels; ++ch) {
+		const Track &tr = tracks[o * channels + ch];
+		int w = width((Channel) ch);
+		int begin = tr.first, end = tr.first + tr.count;
+		times[ch].erase(times[ch].begin() + begin, times[ch].begin() + end);
+		values[ch].erase(values[ch].begin() + begin * w, values[ch].begin() + end * w);
+		tangents_in[ch].erase(tangents_in[ch].begin() + begin * w, tangents_in[ch].begin() + end * w);
+		tangents_out[ch].erase(tangents_out[ch].begin() + begin * w, tangents_out[ch].begin() + end * w);
+		modes[ch].erase(modes[ch].begin() + begin, modes[ch].begin() + end);
+		for (int next = o + 1; next < size(); ++next) {
+			tracks[next * channels + ch].first -= tr.count;
+		}
+	}
+	tracks.erase(tracks.begin() + o * channels, tracks.begin() + (o + 1) * channels);
+	rest.erase(rest.begin() + o * 8, rest.begin() + (o + 1) * 8);
+	objects.erase(objects.begin() + o);
+}
+
+void KeyframeStore::reindex() {
+	by_triangle.clear();
+	for (int i = 0; i < size(); ++i) {
+		by_triangle[objects[i]] = i;
+	}
+}
+
+void KeyframeStore::clear() {
+	objects.clear();
+	by_triangle.clear();
+	rest.clear();
+	tracks.clear();
+	for (int ch = 0; ch < channels; ++ch) {
+		times[ch].clear();
+		values[ch].clear();
+		tangents_in[ch].clear();
+		tangents_out[ch].clear();
+		modes[ch].clear();
+	}
+}
+
+SimdLevel keyframe_kernel() {
+	return active_kernel();
+}
+
+bool set_keyframe_kernel(SimdLevel k) {
+	if (!simd_supported(k)) {
+		return false;
+	}
+	active_kernel() = k;
+	active_curves() = curve_kernel(k);
+	return true;
+}
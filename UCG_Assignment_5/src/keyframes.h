@@ -0,0 +1,196 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "thread_pool.h"
+#include "simd.h"
+#include <vector>
+#include <unordered_map>
+////////////////////////////////////////////////////////////////////////////////
+
+// Keyframe tracks of many animated triangles.
+//
+// Every animated triangle (an object) has a rest pose, the vertices it had
+// when it was added, and one track per channel: position of its barycenter,
+// rotation and uniform scale about it. Tracks have any number of keys.
+//
+// The keys of every track of a channel are stored back to back in contiguous
+// arrays (times, values, tangents, ...) ordered by object, so that evaluating
+// all the objects walks memory linearly. Each track remembers the segment it
+// used last, which answers the next lookup in O(1) during playback and falls
+// back to a binary search when the time jumps.
+//
+// Every segment is a cubic Bezier curve in time: a linear key places the
+// control points on the straight line to the next key, a Catmull-Rom key
+// derives its tangents from its neighbours and a Bezier key uses the tangents
+// it was given. Whole batches of objects are then evaluated by a SIMD kernel.
+class KeyframeStore {
+public:
+	KeyframeStore() : edits(0) { }
+
+	enum Channel {
+		Position = 0,
+		Rotation = 1,
+		Scale = 2
+	};
+	static const int channels = 3;
+
+	// Shape of the segment that starts at a key
+	enum Interpolation {
+		Linear = 0,
+		CatmullRom = 1,
+		Bezier = 2
+	};
+
+	typedef Eigen::Matrix<float, 2, 3> Affine;
+
+	// Number of floats of one key value
+	static int width(Channel c) { return c == Position ? 2 : 1; }
+
+	// Number of animated objects
+	int size() const { return (int) objects.size(); }
+
+	// Triangle animated by object o
+	int triangle(int o) const { return objects[o]; }
+
+	// Object animating triangle t, -1 if none
+	int find(int t) const;
+
+	// Animate triangle t of store from its current vertices, returns the new
+	// object (or the existing one if t is already animated)
+	int add(const TriangleStore &store, int t);
+
+	// Animate triangle t from the given rest pose (see rest_pose)
+	int add(int t, const float *rest_pose);
+
+	// Rest pose of object o: its barycenter then its three vertices relative
+	// to it (8 floats)
+	const float *rest_pose(int o) const { return &rest[o * 8]; }
+
+	// Key every channel of object o at the given time from the current
+	// vertices of its triangle
+	void key(int o, float time, const TriangleStore &store);
+
+	// Insert or replace the key of a channel at the given time, returns its
+	// index. A new key takes the interpolation of the key before it (Linear
+	// for the first one).
+	int set_key(int o, Channel c, float time, const float *value);
+
+	// Make key k of a channel of object o a Bezier key with the given
+	// incoming and outgoing tangents (derivatives in units per second)
+	void set_tangents(int o, Channel c, int k, const float *in, const float *out);
+
+	// Change the interpolation of every key of every track
+	void set_interpolation(Interpolation mode);
+
+	// Change the interpolation of key k of a channel of object o (Bezier keeps
+	// the tangents the key has)
+	void set_interpolation(int o, Channel c, int k, Interpolation mode);
+
+	// Number of keys of a channel of object o
+	int keys(int o, Channel c) const { return tracks[o * channels + c].count; }
+
+	// Time, value, interpolation and tangents of key k of a channel of object o
+	float key_time(int o, Channel c, int k) const { return times[c][tracks[o * channels + c].first + k]; }
+	const float *key_value(int o, Channel c, int k) const { return &values[c][key_index(o, c, k) * width(c)]; }
+	Interpolation key_interpolation(int o, Channel c, int k) const { return (Interpolation) modes[c][key_index(o, c, k)]; }
+	const float *key_tangent_in(int o, Channel c, int k) const { return &tangents_in[c][key_index(o, c, k) * width(c)]; }
+	const float *key_tangent_out(int o, Channel c, int k) const { return &tangents_out[c][key_index(o, c, k) * width(c)]; }
+
+	// Number that changes whenever a track is edited, unique across all the
+	// tracks and edits of the store (and kept by clear())
+	unsigned int revision(int o, Channel c) const { return tracks[o * channels + c].revision; }
+
+	// Time of the last key of all tracks, or of the tracks of object o, 0 if
+	// there is none
+	float end_time() const;
+	float end_time(int o) const;
+
+	// Affine map from the rest pose of every object to its pose at the given
+	// time, written to poses (one per object)
+	void evaluate(float time, std::vector<Affine> &poses, ThreadPool *pool = 0);
+
+	// Sample a channel of object o n times every dt seconds from t0 into out
+	// (width(c) floats per sample). Uniform steps inside a segment are taken by
+	// forward differencing, three additions per float instead of a curve
+	// evaluation.
+	void sample(int o, Channel c, float t0, float dt, int n, float *out);
+
+	// Vertices (one per column) of object o in the given pose
+	Affine vertices(int o, const Affine &pose) const;
+
+	// Pose of object o from the values of its three channels
+	Affine pose(int o, const Eigen::Vector2f &position, float angle, float scale) const;
+
+	// Append the rest pose and every key of object o to out (see restore)
+	void save(int o, std::vector<float> &out) const;
+
+	// Animate triangle t again from floats written by save, returns the object
+	int restore(int t, const float *saved);
+
+	// Mirror TriangleStore::insert / TriangleStore::erase: renumber the
+	// triangles of the objects after t, and drop the object of an erased one
+	void insert_triangle(int t);
+	void erase_triangle(int t);
+
+	void clear();
+
+private:
+	// Range of keys of one track in the arrays of its channel
+	struct Track {
+		int first;
+		int count;
+		// Segment used by the last lookup
+		int cursor;
+		unsigned int revision;
+	};
+
+	// Last revision given to a track
+	unsigned int edits;
+
+	// Triangle of every object
+	std::vector<int> objects;
+	std::unordered_map<int, int> by_triangle;
+
+	// Rest pose of every object (8 floats)
+	std::vector<float> rest;
+
+	// channels tracks per object
+	std::vector<Track> tracks;
+
+	// Keys of every channel, track after track. Values and tangents hold
+	// width() floats per key.
+	std::vector<float> times[channels];
+	std::vector<float> values[channels];
+	std::vector<float> tangents_in[channels];
+	std::vector<float> tangents_out[channels];
+	std::vector<unsigned char> modes[channels];
+
+	// Index of key k of a track in the arrays of its channel
+	int key_index(int o, Channel c, int k) const { return tracks[o * channels + c].first + k; }
+
+	// Index of the segment of track tr containing time (the first key index)
+	int segment(Track &tr, const float *t, float time) const;
+
+	// Recompute the tangents of the Catmull-Rom keys among keys [k - 1, k + 1] of a track
+	void update_tangents(const Track &tr, Channel c, int k);
+
+	// Parameter in [0, 1] of time and the four Bezier control points (width(c)
+	// floats each) of the segment of a track containing it
+	float control_points(Track &tr, Channel c, float time, float *p) const;
+
+	void evaluate_block(int first, int n, float time, Affine *poses);
+
+	// Remove object o and its keys, without renumbering the triangles
+	void drop(int o);
+
+	// Rebuild by_triangle from objects
+	void reindex();
+};
+
+// Kernel used by KeyframeStore::evaluate, the best supported one by default
+SimdLevel keyframe_kernel();
+
+// Use kernel k from now on, returns false (and keeps the current kernel) if it
+// is not supported
+bool set_keyframe_kernel(SimdLevel k);
@@ -3,57 +3,320 @@
 ////////////////////////////////////////////////////////////////////////////////
 // OpenGL Helpers to reduce the clutter
 #include "helpers.h"
+// Growable triangle soup
+#include "triangle_store.h"
+// Acceleration structure for picking
+#include "spatial_index.h"
+// Bulk rotate/scale/translate of triangles
+#include "transform.h"
+// View of the editor
+#include "camera.h"
+#include "thread_pool.h"
+// Keyframe animation of many triangles
+#include "keyframes.h"
+#include "bake.h"
+#include "timeline.h"
+// Text scenes and the command-line renderer
+#include "scene_io.h"
+#include "scene_file.h"
+#include "offline.h"
+#include "importers.h"
+// Undo / redo of the edits
+#include "history.h"
+#include "profiler.h"
+// Recording and replay of the input
+#include "input_log.h"
 // GLFW is necessary to handle the OpenGL context
 #include <GLFW/glfw3.h>
 // Linear Algebra Library
 #include <Eigen/Dense>
 #include <Eigen/LU>
-// Timer
+#include <algorithm>
 #include <chrono>
 #include <thread>
 ////////////////////////////////////////////////////////////////////////////////
 
 // VertexBufferObject wrapper
 VertexBufferObject VBO;
+VertexBufferObject VBO_color;
+VertexBufferObject VBO_state;
+// Per-triangle transforms, read by the vertex shader through a buffer texture
+VertexBufferObject VBO_transform;
+BufferTexture Transform_texture;
 //VAO
 VertexArrayObject VAO;
 //OpenGL Program
 Program program;
-
-// Contains the vertex positions
-Eigen::Matrix<float, 6, 30> V;
+// Uniforms of the program, resolved once after linking
+Uniform<Eigen::Matrix3f> u_translation;
+Uniform<Eigen::Matrix3f> u_view;
+Uniform<float> u_shift_x;
+Uniform<float> u_shift_y;
+Uniform<int> u_transforms;
+
+// Contains the vertex positions and colors of the triangle soup
+TriangleStore Triangles;
+// Spatial indices over the committed triangles (the first num_Triangles) and their vertices
+TriangleGrid Grid;
+VertexGrid Vertex_grid;
+// Number of triangles when the indices were last built
+int indexed_at_build = 0;
+// Vertices of the committed triangles on screen, when the view does not show
+// all of them
+IndexBufferObject Visible_indices;
+std::vector<unsigned int> visible_vertices;
+// Worker threads for the bulk edits
+ThreadPool Workers;
+// Edits that Ctrl+Z / Ctrl+Y revert and apply again, at most 8 MB of them
+EditHistory History(8 << 20);
+// Frame profiler, F9 starts it and stops it, writing the trace
+Profiler Profile;
+const char *trace_path = "profile.json";
+
+// Input of the session, written with --record or replayed with --replay
+InputRecorder Recorder;
+double record_start = 0;
+// While replaying, the callbacks see the recorded cursor and window sizes
+bool replaying = false;
+double replay_cursor[2] = { 0, 0 };
+int replay_window[2];
+int replay_framebuffer[2];
 
 Eigen::Matrix<float, 3, 3> mat_Transform = Eigen::MatrixXf::Identity(3, 3);
 
-Eigen::Matrix<float, 3, 3> mat_View = Eigen::MatrixXf::Identity(3, 3);
-
-Eigen::Matrix<float, 2, 30> Key_frame_pos;
-
-//store triangle coordinates for later calculatios
-std::vector<Eigen::Vector2d> Triangles;
+// View of the scene, the keypad + and - zoom, W A S D pan
+Camera2D Camera;
 
 static int vert_count = 0;
 static int num_Triangles = 0;
 
+// Binary scene opened at startup and written by Ctrl+S
+std::string scene_path = "scene.ucg";
+
+const float pi = 3.14159265f;
+
+// Color mode only picks vertices closer than this to the cursor, in normalized
+// device coordinates
+const float vertex_pick_radius = 0.1f;
+// Step of the zoom and pan keys, in normalized device coordinates for the pan
+const float zoom_step = 1.1f;
+const float pan_step = 0.1f;
+
+// Scenes with at least this many vertices switch the position stream to the
+// mapped ring buffer as soon as an edit touches more than half of them
+const int streaming_threshold = 1 << 16;
+
 //key to enable/disable insert mode
 bool Key_i = false;
 
 bool triangle_selected = false;
 int triangle_selected_index = -1;
-float shift_x, current_x;
-float shift_y, current_y;
+// World position of the cursor during a drag
+Eigen::Vector2f drag_cursor;
+// Translation of the triangle dragged since the button was pressed
+Eigen::Vector2f drag_offset = Eigen::Vector2f::Zero();
 Eigen::Vector3f color;
 bool color_change = false;
 bool mouse_move_flag = false;
 bool apply_shader_translation = false;
 int closer_vertex = -1;
-int key_frames_count = 0;
-int selected_triangle_animation = -1;
+// Drags of animated triangles record key frames
 bool animation_on = false;
+// Key frames of every animated triangle and their playback, advanced by the main loop
+KeyframeStore Keyframes;
+std::vector<KeyframeStore::Affine> Poses;
+Timeline Animation;
+// Play from quantized samples of the tracks instead of evaluating the curves
+KeyframeBake Baked;
+bool bake_on = false;
+KeyframeStore::Interpolation animation_curve = KeyframeStore::Linear;
+// Time between two consecutive key frames, in seconds
+const double key_frame_duration = 0.4;
+// Step of the arrow keys when scrubbing, in seconds
+const double scrub_step = 1.0 / 30.0;
+// Triangle currently drawn in the Selected state
+int highlighted_triangle = -1;
+
+// The window is only redrawn when something changed
+bool redraw_needed = true;
+// Latest cursor position not applied yet, motion events are coalesced per frame
+bool cursor_moved = false;
+double cursor_x, cursor_y;
 
 //forward declairations
 void findselectedtriangle(double x, double y);
+void findclosestvertex(double x, double y);
 void removeselectedtriangle();
+void undo_edit();
+void redo_edit();
+
+// Schedule a redraw for the next iteration of the main loop
+void request_redraw()
+{
+    redraw_needed = true;
+}
+
+// Index the first n committed triangles from scratch
+void build_indices(int n)
+{
+    Grid.build(Triangles, n);
+    Vertex_grid.build(Triangles, n);
+    indexed_at_build = n;
+}
+
+// Index the committed triangles up to n. The cell sizes of the grids suit the
+// scene of their last build, so they are rebuilt once it doubled (at most
+// log n times).
+void index_triangles(int n)
+{
+    if (n >= 2 * std::max(indexed_at_build, 128))
+    {
+        build_indices(n);
+        return;
+    }
+    while (Grid.size() < n)
+    {
+        Grid.append(Triangles);
+        Vertex_grid.append(Triangles);
+    }
+}
+
+// Mark the vertices of triangle t as modified, they are sent with the next upload
+// and the spatial index is refreshed
+void invalidate_positions(int t)
+{
+    // The GPU receives the current positions, so it must not apply the
+    // motion accumulated in the transform on top of them
+    Triangles.reset_transform(t);
+    VBO.invalidate(t * 3, 3);
+    VBO_transform.invalidate(t, 1);
+    if (t < Grid.size())
+    {
+        Grid.update(Triangles, t);
+        Vertex_grid.update(Triangles, t);
+    }
+}
+
+// Triangles [begin, end) moved through their transforms, only the transforms
+// (6 floats per triangle) are sent with the next upload. The spatial indices
+// are rebuilt when most of the committed triangles moved.
+void invalidate_transforms(int begin, int end)
+{
+    VBO_transform.invalidate(begin, end - begin);
+    int indexed = std::max(0, std::min(end, Grid.size()) - begin);
+    if (indexed * 2 > Grid.size())
+    {
+        build_indices(Grid.size());
+    }
+    else
+    {
+        for (int t = begin; t < begin + indexed; t++)
+        {
+            Grid.update(Triangles, t);
+            Vertex_grid.update(Triangles, t);
+        }
+    }
+}
+
+void invalidate_colors(int t)
+{
+    VBO_color.invalidate(t * 3, 3);
+}
+
+// Change the color of vertex v, it is only re-uploaded if the color differs
+void set_vertex_color(int v, const Eigen::Vector3f &c)
+{
+    if (Triangles.colors.col(v) != c)
+    {
+        History.record(Edit::recolor(v, Triangles.colors.col(v), c));
+        Triangles.colors.col(v) = c;
+        VBO_color.invalidate(v, 1);
+    }
+}
+
+void set_triangle_state(int t, TriangleStore::State state)
+{
+    Triangles.set_state(t, state);
+    VBO_state.invalidate(t * 3, 3);
+}
+
+// Move the selection highlight to triangle t (-1 for none), 6 floats at most are re-uploaded
+void set_highlight(int t)
+{
+    if (t == highlighted_triangle)
+    {
+        return;
+    }
+    if (highlighted_triangle != -1 && highlighted_triangle < num_Triangles)
+    {
+        set_triangle_state(highlighted_triangle, TriangleStore::Normal);
+    }
+    if (t != -1)
+    {
+        set_triangle_state(t, TriangleStore::Selected);
+    }
+    highlighted_triangle = t;
+}
+
+// The positions just sent hold the motion of their triangles already (a
+// reallocation, the switch to streaming or a region of the ring catching up
+// sends moved triangles), so their transforms are reset. The other regions of
+// the ring still have the positions before the motion and are sent them too.
+void rebase_transforms()
+{
+    for (size_t i = 0; i < VBO.sent.ranges.size(); i++)
+    {
+        int end = std::min((int) VBO.sent.ranges[i].end / 3, Triangles.size());
+        for (int t = (VBO.sent.ranges[i].begin + 2) / 3; t < end; t++)
+        {
+            if (Triangles.transformed(t))
+            {
+                Triangles.reset_transform(t);
+                VBO_transform.invalidate(t, 1);
+                if (VBO.streaming)
+                {
+                    VBO.invalidate(t * 3, 3);
+                }
+            }
+        }
+    }
+}
+
+// Upload the modified parts of both vertex streams to the GPU
+void upload_triangles()
+{
+    ProfileZone zone(Profile, "upload_triangles");
+    if (!VBO.streaming && (Triangles.vertices() >= streaming_threshold) &&
+        (VBO.dirty.columns() * 2 >= (size_t) Triangles.vertices()))
+    {
+        VBO.init_streaming(3);
+    }
+    VBO.flush(Triangles.position_data(), 3, Triangles.vertices());
+    rebase_transforms();
+    VBO_color.flush(Triangles.color_data(), 3, Triangles.vertices());
+    VBO_state.flush(Triangles.state_data(), 1, Triangles.vertices());
+    VBO_transform.flush(Triangles.transform_data(), 6, Triangles.size());
+}
+
+// Apply m about the barycenter of the selected triangle, or of every committed
+// triangle when none is selected. The positions are uploaded once.
+void transform_selection(const TriangleTransform &m)
+{
+    if (triangle_selected && triangle_selected_index != -1)
+    {
+        transform_triangles(Triangles, &triangle_selected_index, 1, m);
+        invalidate_transforms(triangle_selected_index, triangle_selected_index + 1);
+        History.record(Edit::transformed(triangle_selected_index, triangle_selected_index + 1, m));
+    }
+    else if (num_Triangles > 0)
+    {
+        transform_triangles(Triangles, 0, num_Triangles, m, &Workers);
+        invalidate_transforms(0, num_Triangles);
+        History.record(Edit::transformed(0, num_Triangles, m));
+    }
+    upload_triangles();
+    request_redraw();
+}
 
 void init()
 {
@@ -68,19 +331,16 @@ void init()
     // Initialize the VBO with the vertices data
     // A VBO is a data container that lives in the GPU memory
     VBO.init();
+    VBO_color.init();
+    VBO_state.init();
+    VBO_transform.init();
+    Visible_indices.init();
 
-    V.resize(6, 30);
-    VBO.update(V);
+    Triangles.reserve(1024);
+    upload_triangles();
 
-    //initialize view matrix
-    Eigen::Vector3f camdirection = Eigen::Vector3f(0, 0, 1);
-    Eigen::Vector3f up = Eigen::Vector3f(0.0, 1.0, 0.0);
-    Eigen::Vector3f camrigh = up.cross(camdirection);
-    Eigen::Vector3f camup = camdirection.cross(camrigh);
-
-    mat_View.col(0) << camrigh[0],camrigh[1], 0.1;
-    mat_View.col(1) << camup[0],camup[1], 0.1;
-    mat_View.col(2) << camdirection[0],camdirection[1],1;
+    // Three RG texels per triangle: the columns of its 2x3 transform
+    Transform_texture.init(VBO_transform, GL_RG32F);
 
     // Initialize the OpenGL Program
     // A program controls the OpenGL pipeline and it must contains
@@ -89,17 +349,32 @@ void init()
         #version 150 core
 
         in vec3 position;
+        uniform samplerBuffer transforms;
         uniform float shift_x;
         uniform float shift_y;
         uniform mat3 Translation;
         uniform mat3 viewMatrix;
         in vec3 triangleColor;
+        in float state;
         out vec3 o_color;
 
         void main() {
-            vec3 T_position = viewMatrix * Translation * position;
+            // Motion of the triangle since its positions were uploaded
+            int t = gl_VertexID / 3;
+            mat3 motion = mat3(vec3(texelFetch(transforms, t * 3 + 0).xy, 0.0),
+                               vec3(texelFetch(transforms, t * 3 + 1).xy, 0.0),
+                               vec3(texelFetch(transforms, t * 3 + 2).xy, 1.0));
+            vec3 T_position = viewMatrix * Translation * motion * position;
             gl_Position = vec4(T_position[0] - shift_x, T_position[1] - shift_y, 0.0, 1.0);
-            o_color = triangleColor;
+            if (state == 1.0) {
+                // selected triangle
+                o_color = vec3(0.0, 0.0, 1.0);
+            } else if (state == 2.0) {
+                // triangle being inserted
+                o_color = mix(triangleColor, vec3(1.0), 0.5);
+            } else {
+                o_color = triangleColor;
+            }
         }
     )";
 
@@ -120,14 +395,35 @@ void init()
     program.init(vertex_shader, fragment_shader, "outColor");
     program.bind();
 
+    u_translation = program.uniform_handle<Eigen::Matrix3f>("Translation");
+    u_view = program.uniform_handle<Eigen::Matrix3f>("viewMatrix");
+    u_shift_x = program.uniform_handle<float>("shift_x");
+    u_shift_y = program.uniform_handle<float>("shift_y");
+    u_transforms = program.uniform_handle<int>("transforms");
+
     // The vertex shader wants the position of the vertices as an input.
     // The following line connects the VBO we defined above with the position "slot"
     // in the vertex shader
-    program.bindVertexAttribArray("position","triangleColor", VBO);
+    program.bindVertexAttribArray("position", VBO);
+    program.bindVertexAttribArray("triangleColor", VBO_color);
+    program.bindVertexAttribArray("state", VBO_state);
+}
+
+// World rectangle seen through the view and the shader translation, which
+// only scales x (by 1 or 2)
+void visible_rect(Eigen::Vector2f &min, Eigen::Vector2f &max)
+{
+    const Eigen::Matrix3f &to_world = Camera.inverse_view();
+    min = (to_world * Eigen::Vector3f(-1.0f, -1.0f, 1.0f)).head<2>();
+    max = (to_world * Eigen::Vector3f(1.0f, 1.0f, 1.0f)).head<2>();
+    min[0] /= mat_Transform(0, 0);
+    max[0] /= mat_Transform(0, 0);
 }
 
 void draw_triangle(GLFWwindow* window)
 {
+    ProfileZone zone(Profile, "draw_triangle");
+
     // Set the size of the viewport (canvas) to the size of the application window (framebuffer)
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
@@ -142,6 +438,7 @@ void draw_triangle(GLFWwindow* window)
     program.bind();
 
     // Clear the framebuffer
+    Profile.begin_gpu("draw");
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
@@ -154,156 +451,210 @@ void draw_triangle(GLFWwindow* window)
         mat_Transform.col(0) << 1.0, 0, 0;
     }
 
-    glUniformMatrix3fv(program.uniform("Translation"), 1, false, &mat_Transform(0,0));
-    glUniformMatrix3fv(program.uniform("viewMatrix"), 1, false, &mat_View(0,0));
+    // Only the uniforms whose value changed since the last frame reach OpenGL
+    u_translation.set(mat_Transform);
+    u_view.set(Camera.view());
 
-    // Draw a triangle
-    if (vert_count != 0) {
-        for (int i = 0; i <= num_Triangles; i++) {
-            if ((i == triangle_selected_index) && triangle_selected)
-            {
-                V.col((i * 3) + 0) << V.coeff(0, (i * 3) + 0), V.coeff(1, (i * 3) + 0), V.coeff(2, (i * 3) + 0), 0.0, 0.0, 1.0;
-                V.col((i * 3) + 1) << V.coeff(0, (i * 3) + 1), V.coeff(1, (i * 3) + 1), V.coeff(2, (i * 3) + 1), 0.0, 0.0, 1.0;
-                V.col((i * 3) + 2) << V.coeff(0, (i * 3) + 2), V.coeff(1, (i * 3) + 2), V.coeff(2, (i * 3) + 2), 0.0, 0.0, 1.0;
-                VBO.update(V);
-                glUniform1f(program.uniform("shift_x"), 0.0);
-                glUniform1f(program.uniform("shift_y"), 0.0);
-
-            }
-            else if ((i == triangle_selected_index) && color_change && (closer_vertex != -1))
-            {
-                V.col((i * 3) + closer_vertex) << V.coeff(0, (i * 3) + closer_vertex), V.coeff(1, (i * 3) + closer_vertex), V.coeff(1, (i * 3) + closer_vertex), color[0], color[1], color[2];
-                VBO.update(V);
-                glUniform1f(program.uniform("shift_x"), 0.0);
-                glUniform1f(program.uniform("shift_y"), 0.0);
-            }
-            else
+    // The selection is drawn through the state stream, so the cost of a frame
+    // does not depend on what is selected
+    set_highlight(triangle_selected ? triangle_selected_index : -1);
+    upload_triangles();
+    if (VBO.streaming)
+    {
+        // Read the positions from the region written last
+        program.bindVertexAttribArray("position", VBO);
+    }
+    u_shift_x.set(0.0f);
+    u_shift_y.set(0.0f);
+    Transform_texture.bind(0);
+    u_transforms.set(0);
+
+    // Draw the committed triangles whose grid cells overlap the screen, in
+    // the order of the store, or all of them with a single range when the
+    // whole scene is on screen
+    if (num_Triangles > 0)
+    {
+        ProfileZone cull_zone(Profile, "cull");
+        Eigen::Vector2f min, max;
+        visible_rect(min, max);
+        if (Grid.covers(min[0], min[1], max[0], max[1]))
+        {
+            glDrawArrays(GL_TRIANGLES, 0, num_Triangles * 3);
+        }
+        else
+        {
+            Grid.visible(min[0], min[1], max[0], max[1], visible_vertices);
+            if (!visible_vertices.empty())
             {
-                V.col((i * 3) + 0) << V.coeff(0, (i * 3) + 0), V.coeff(1, (i * 3) + 0), V.coeff(2, (i * 3) + 0), 1.0, 0.0, 0.0;
-                V.col((i * 3) + 1) << V.coeff(0, (i * 3) + 1), V.coeff(1, (i * 3) + 1), V.coeff(2, (i * 3) + 1), 1.0, 0.0, 0.0;
-                V.col((i * 3) + 2) << V.coeff(0, (i * 3) + 2), V.coeff(1, (i * 3) + 2), V.coeff(2, (i * 3) + 2), 1.0, 0.0, 0.0;
-                VBO.update(V);
-                glUniform1f(program.uniform("shift_x"), 0.0);
-                glUniform1f(program.uniform("shift_y"), 0.0);
+                Visible_indices.update(visible_vertices.data(), visible_vertices.size());
+                glDrawElements(GL_TRIANGLES, (GLsizei) visible_vertices.size(), GL_UNSIGNED_INT, 0);
             }
+        }
+    }
 
-            if (vert_count == i * 3 + 1)
-            {
-                glDrawArrays(GL_LINES, i * 3, 2);
-            }
-            else
-            {
-                glDrawArrays(GL_TRIANGLES, i * 3, 3);
-            }
+    // Draw the triangle being inserted, a segment until the second click
+    if (Triangles.size() > num_Triangles)
+    {
+        if (vert_count == num_Triangles * 3 + 1)
+        {
+            glDrawArrays(GL_LINES, num_Triangles * 3, 2);
+        }
+        else
+        {
+            glDrawArrays(GL_TRIANGLES, num_Triangles * 3, 3);
         }
     }
+    VBO.fence();
+    Profile.end_gpu();
+
     // Swap front and back buffers
+    ProfileZone swap_zone(Profile, "swap");
     glfwSwapBuffers(window);
 }
 
-void getWorldPos(GLFWwindow* window, double &x, double &y)
+// Size of the framebuffer and of the window seen by the input, the recorded
+// ones when replaying
+void input_sizes(GLFWwindow* window, int &width, int &height, int &width_window, int &height_window)
 {
-    // Get viewport size (canvas in number of pixels)
-    int width, height;
+    if (replaying)
+    {
+        width = replay_framebuffer[0];
+        height = replay_framebuffer[1];
+        width_window = replay_window[0];
+        height_window = replay_window[1];
+        return;
+    }
     glfwGetFramebufferSize(window, &width, &height);
-
-    // Get the size of the window (may be different than the canvas size on retina displays)
-    int width_window, height_window;
     glfwGetWindowSize(window, &width_window, &height_window);
+}
 
-    // Get the position of the mouse in the window
-    double xpos, ypos;
-    glfwGetCursorPos(window, &xpos, &ypos);
+void cursor_position(GLFWwindow* window, double &x, double &y)
+{
+    if (replaying)
+    {
+        x = replay_cursor[0];
+        y = replay_cursor[1];
+        return;
+    }
+    glfwGetCursorPos(window, &x, &y);
+}
+
+// World position of the cursor position (x, y), in window coordinates
+Eigen::Vector2f cursor_to_world(GLFWwindow* window, double x, double y)
+{
+    // Get viewport size (canvas in number of pixels) and the size of the
+    // window (may be different than the canvas size on retina displays)
+    int width, height;
+    int width_window, height_window;
+    input_sizes(window, width, height, width_window, height_window);
 
     // Deduce position of the mouse in the viewport
     double highdpi = (double)width / (double)width_window;
-    xpos *= highdpi;
-    ypos *= highdpi;
+    Camera.set_viewport(width, height);
+    return Camera.screen_to_world(Eigen::Vector2f(x * highdpi, y * highdpi));
+}
 
-    // Convert screen position to world coordinates
-    x = ((xpos / double(width)) * 2) - 1;
-    y = (((height - 1 - ypos) / double(height)) * 2) - 1; // NOTE: y axis is flipped in glfw
+void getWorldPos(GLFWwindow* window, double &x, double &y)
+{
+    // Get the position of the mouse in the window
+    double xpos, ypos;
+    cursor_position(window, xpos, ypos);
+
+    Eigen::Vector2f p = cursor_to_world(window, xpos, ypos);
+    x = p[0];
+    y = p[1];
 }
 
-void mouse_curson_pos_callback(GLFWwindow* window, double x, double y)
+void move_cursor(GLFWwindow* window, double x, double y)
 {
+    ProfileZone zone(Profile, "move_cursor");
     if (vert_count != 0 && Key_i && !triangle_selected)
     {
-        // Get viewport size (canvas in number of pixels)
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
-
-        // Get the size of the window (may be different than the canvas size on retina displays)
-        int width_window, height_window;
-        glfwGetWindowSize(window, &width_window, &height_window);
-
-        // Deduce position of the mouse in the viewport
-        double highdpi = (double)width / (double)width_window;
-        x *= highdpi;
-        y *= highdpi;
-
+        Eigen::Vector2f p = cursor_to_world(window, x, y);
         if (vert_count == num_Triangles * 3 + 1)
         {
-            double w_x, w_y;
-            // Convert screen position to world coordinates
-            w_x = ((x / double(width)) * 2) - 1;
-            w_y = (((height - 1 - y) / double(height)) * 2) - 1; // NOTE: y axis is flipped in glfw
-            Eigen::Vector3f Vin = Eigen::Vector3f(w_x, w_y, 0.0);
-            Eigen::Vector3f Vout = mat_View.inverse() * Vin;
-            V.col((num_Triangles * 3) + 1) << Vout[0], Vout[1], 1.0, 1.0, 0.0, 0.0;
-            V.col((num_Triangles * 3) + 2) << Vout[0], Vout[1], 1.0, 1.0, 0.0, 0.0;
+            Triangles.positions.col((num_Triangles * 3) + 1) << p[0], p[1], 1.0;
+            Triangles.positions.col((num_Triangles * 3) + 2) << p[0], p[1], 1.0;
         }
         else if (vert_count == num_Triangles * 3 + 2)
         {
-            double w_x, w_y;
-            // Convert screen position to world coordinates
-            w_x = ((x / double(width)) * 2) - 1;
-            w_y = (((height - 1 - y) / double(height)) * 2) - 1; // NOTE: y axis is flipped in glfw
-            Eigen::Vector3f Vin = Eigen::Vector3f(w_x, w_y, 0.0);
-            Eigen::Vector3f Vout = mat_View.inverse() * Vin;
-            V.col((num_Triangles * 3) + 2) << Vout[0], Vout[1], 1.0, 1.0, 0.0, 0.0;
+            Triangles.positions.col((num_Triangles * 3) + 2) << p[0], p[1], 1.0;
         }
-        VBO.update(V);
+        invalidate_positions(num_Triangles);
+        upload_triangles();
+        request_redraw();
     }
     else if (triangle_selected && (triangle_selected_index != -1) && mouse_move_flag)
     {
-        // Get viewport size (canvas in number of pixels)
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
-
-        // Get the size of the window (may be different than the canvas size on retina displays)
-        int width_window, height_window;
-        glfwGetWindowSize(window, &width_window, &height_window);
-        // Deduce position of the mouse in the viewport
-        double highdpi = (double)width / (double)width_window;
-        x *= highdpi;
-        y *= highdpi;
-
-        double w_x, w_y;
-        // Convert screen position to world coordinates
-        w_x = ((x / double(width)) * 2) - 1;
-        w_y = (((height - 1 - y) / double(height)) * 2) - 1; // NOTE: y axis is flipped in glfw
+        // The triangle follows the cursor in world space, whatever the zoom
+        Eigen::Vector2f p = cursor_to_world(window, x, y);
+        Eigen::Vector2f shift = p - drag_cursor;
+        drag_cursor = p;
+
+        // Only the transform of the dragged triangle (6 floats) is sent
+        drag_offset += shift;
+        transform_triangles(Triangles, &triangle_selected_index, 1, TriangleTransform::translation(shift));
+        invalidate_transforms(triangle_selected_index, triangle_selected_index + 1);
+        upload_triangles();
+        request_redraw();
+    }
+}
 
-        shift_x = current_x - w_x;
-        shift_y = current_y - w_y;
+// Log an event of the session when recording
+void record_input(InputEvent::Kind kind, int a, int b, int c, int d, double x = 0, double y = 0)
+{
+    if (Recorder.is_open())
+    {
+        InputEvent e = { kind, glfwGetTime() - record_start, { a, b, c, d }, x, y };
+        Recorder.record(e);
+    }
+}
 
-        current_x = w_x;
-        current_y = w_y;
+void mouse_curson_pos_callback(GLFWwindow*, double x, double y)
+{
+    record_input(InputEvent::CursorPos, 0, 0, 0, 0, x, y);
+    // Only remember the position, a fast drag produces many events per frame
+    cursor_x = x;
+    cursor_y = y;
+    cursor_moved = true;
+}
 
-        int pos_0 = triangle_selected_index * 3 + 0;
-        int pos_1 = triangle_selected_index * 3 + 1;
-        int pos_2 = triangle_selected_index * 3 + 2;
+// Apply the latest pending cursor position, if any
+void flush_cursor_motion(GLFWwindow* window)
+{
+    if (cursor_moved)
+    {
+        cursor_moved = false;
+        move_cursor(window, cursor_x, cursor_y);
+    }
+}
 
-        V.col(pos_0) << V.coeff(0, pos_0) - shift_x, V.coeff(1, pos_0) - shift_y, 1.0, 1.0, 0.0, 0.0;
-        V.col(pos_1) << V.coeff(0, pos_1) - shift_x, V.coeff(1, pos_1) - shift_y, 1.0, 1.0, 0.0, 0.0;
-        V.col(pos_2) << V.coeff(0, pos_2) - shift_x, V.coeff(1, pos_2) - shift_y, 1.0, 1.0, 0.0, 0.0;
+void window_refresh_callback(GLFWwindow*)
+{
+    request_redraw();
+}
 
-        VBO.update(V);
+void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+    // The sizes are only read to record them
+    (void) window;
+    (void) width;
+    (void) height;
+    if (Recorder.is_open())
+    {
+        int width_window, height_window;
+        glfwGetWindowSize(window, &width_window, &height_window);
+        record_input(InputEvent::Resize, width_window, height_window, width, height);
     }
-    draw_triangle(window);
+    request_redraw();
 }
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+    ProfileZone zone(Profile, "mouse_button_callback");
+    record_input(InputEvent::MouseButton, button, action, mods, 0);
+
+    // Motion that happened before the click must be applied first
+    flush_cursor_motion(window);
 
     double xworld, yworld;
     getWorldPos(window, xworld, yworld);
@@ -312,41 +663,53 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && Key_i) {
         if (vert_count == (num_Triangles * 3)) {
-            Eigen::Vector3f Vin = Eigen::Vector3f(xworld, yworld, 0.0);
-            Eigen::Vector3f Vout = mat_View.inverse() * Vin;
-            V.col((num_Triangles * 3) + 0) << Vout[0], Vout[1], 1.0, 1.0, 0.0, 0.0;
-            V.col((num_Triangles * 3) + 1) << Vout[0], Vout[1], 1.0, 1.0, 0.0, 0.0;
-            V.col((num_Triangles * 3) + 2) << Vout[0], Vout[1], 1.0, 1.0, 0.0, 0.0;
+            Eigen::Vector2f p(xworld, yworld);
+            int t = Triangles.append(p, p, p, Eigen::Vector3f(1.0, 0.0, 0.0));
+            invalidate_positions(t);
+            invalidate_colors(t);
+            set_triangle_state(t, TriangleStore::Preview);
         }
     }
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE && Key_i) {
         vert_count++;
         if (vert_count == (num_Triangles * 3) + 3)
         {
+            set_triangle_state(num_Triangles, TriangleStore::Normal);
             num_Triangles++;
+            index_triangles(num_Triangles);
+            History.record(Edit::insert(Triangles, num_Triangles - 1));
         }
     }
     // Upload the change to the GPU
-    VBO.update(V);
+    upload_triangles();
 
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && triangle_selected)
     {
-        if(animation_on){
-            Key_frame_pos.col(((key_frames_count-1) * 3) + 0)<<V.coeff(0, (triangle_selected_index * 3) + 0), V.coeff(1, (triangle_selected_index * 3) + 0);
-            Key_frame_pos.col(((key_frames_count-1) * 3) + 1)<<V.coeff(0, (triangle_selected_index * 3) + 1), V.coeff(1, (triangle_selected_index * 3) + 1);
-            Key_frame_pos.col(((key_frames_count-1) * 3) + 2)<<V.coeff(0, (triangle_selected_index * 3) + 2), V.coeff(1, (triangle_selected_index * 3) + 2);
+        // The first key of an animated triangle is its pose before the first drag
+        int o = animation_on ? Keyframes.find(triangle_selected_index) : -1;
+        if (o != -1 && Keyframes.keys(o, KeyframeStore::Position) == 0)
+        {
+            Keyframes.key(o, 0, Triangles);
         }
         double x, y;
-        glfwGetCursorPos(window, &x, &y);
+        cursor_position(window, x, y);
         mouse_move_flag = true;
-        mouse_curson_pos_callback(window, x, y);
+        drag_offset.setZero();
+        move_cursor(window, x, y);
     }
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE && triangle_selected)
     {
-        if(animation_on){
-            Key_frame_pos.col(((key_frames_count) * 3) + 0)<<V.coeff(0, (triangle_selected_index * 3) + 0), V.coeff(1, (triangle_selected_index * 3) + 0);
-            Key_frame_pos.col(((key_frames_count) * 3) + 1)<<V.coeff(0, (triangle_selected_index * 3) + 1), V.coeff(1, (triangle_selected_index * 3) + 1);
-            Key_frame_pos.col(((key_frames_count) * 3) + 2)<<V.coeff(0, (triangle_selected_index * 3) + 2), V.coeff(1, (triangle_selected_index * 3) + 2);
+        // Every drag adds a key frame one step after the last one
+        int o = animation_on ? Keyframes.find(triangle_selected_index) : -1;
+        if (o != -1)
+        {
+            Keyframes.key(o, Keyframes.end_time(o) + key_frame_duration, Triangles);
+        }
+        // The whole drag is undone at once
+        if (triangle_selected_index != -1 && !drag_offset.isZero(0))
+        {
+            History.record(Edit::transformed(triangle_selected_index, triangle_selected_index + 1,
+                TriangleTransform::translation(drag_offset)));
         }
         triangle_selected = false;
         mouse_move_flag = false;
@@ -354,12 +717,150 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
     }
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE && color_change)
     {
-        triangle_selected_index = -1;
-        findselectedtriangle(xworld, yworld);
+        findclosestvertex(xworld, yworld);
+    }
+    request_redraw();
+}
+
+// Pose of the animated triangles at the current time of the timeline
+void apply_animation()
+{
+    ProfileZone zone(Profile, "apply_animation");
+    if (bake_on)
+    {
+        // Only the tracks edited since the last frame are sampled again
+        Baked.update(Keyframes, &Workers);
+        Baked.evaluate(Keyframes, (float) Animation.current(), Poses, &Workers);
+    }
+    else
+    {
+        Keyframes.evaluate((float) Animation.current(), Poses, &Workers);
+    }
+
+    for (int o = 0; o < Keyframes.size(); o++)
+    {
+        int t = Keyframes.triangle(o);
+        KeyframeStore::Affine vertices = Keyframes.vertices(o, Poses[o]);
+        // Only the transform of the triangle is sent, unless it is degenerate
+        if (move_triangle(Triangles, t, vertices))
+        {
+            invalidate_transforms(t, t + 1);
+        }
+        else
+        {
+            Triangles.set(t, vertices.col(0), vertices.col(1), vertices.col(2));
+            invalidate_positions(t);
+        }
+    }
+    upload_triangles();
+    request_redraw();
+}
+
+// Start playing the key frames along the given curve, pause if they already are
+void play_animation(KeyframeStore::Interpolation curve)
+{
+    if (Animation.is_playing() && animation_curve == curve)
+    {
+        Animation.pause();
+        return;
+    }
+    animation_curve = curve;
+    Keyframes.set_interpolation(curve);
+    Animation.set_length(Keyframes.end_time());
+    Animation.play();
+    apply_animation();
+}
+
+// Replace the scene with the one stored at path. The streams of the file are
+// laid out like the GPU buffers, so they are uploaded straight from the mapping.
+bool open_scene(const std::string &path)
+{
+    SceneFile file;
+    if (!file.open(path))
+    {
+        return false;
+    }
+    Animation.stop();
+    Baked.clear();
+    History.clear();
+    set_highlight(-1);
+    triangle_selected_index = -1;
+
+    file.load_triangles(Triangles);
+    file.load_keyframes(Keyframes);
+    animation_on = Keyframes.size() > 0;
+    Camera.set_view(file.view());
+    num_Triangles = file.triangles();
+    vert_count = num_Triangles * 3;
+    build_indices(num_Triangles);
+
+    VBO.update(file.positions(), 3, num_Triangles * 3);
+    VBO_color.update(file.colors(), 3, num_Triangles * 3);
+    VBO_transform.update(file.transforms(), 6, num_Triangles);
+    VBO_state.update(Triangles.state_data(), 1, num_Triangles * 3);
+    request_redraw();
+    return true;
+}
+
+// Append the triangles of an STL, OBJ or CSV file to the scene. The spatial
+// indices are fed batch by batch while the file is read.
+bool import_scene(const std::string &path)
+{
+    // Deletions are undone against the last triangle at the time of the edit
+    History.clear();
+    int first = Triangles.size();
+    int imported = import_triangles(path, Triangles, &Workers, [](int begin, int count)
+    {
+        index_triangles(begin + count);
+    });
+    // Keep the batches read before an error
+    num_Triangles = Triangles.size();
+    vert_count = num_Triangles * 3;
+    int count = num_Triangles - first;
+    VBO.invalidate(first * 3, count * 3);
+    VBO_color.invalidate(first * 3, count * 3);
+    VBO_state.invalidate(first * 3, count * 3);
+    VBO_transform.invalidate(first, count);
+    upload_triangles();
+    request_redraw();
+    if (imported >= 0)
+    {
+        printf("Imported %d triangles from %s\n", imported, path.c_str());
+    }
+    return imported >= 0;
+}
+
+// Frame time percentiles of the last frames drawn
+void print_profile()
+{
+    Profiler::Summary s = Profile.summary();
+    printf("%d frames: cpu p50 %.2f ms, p95 %.2f ms, p99 %.2f ms", s.frames, s.cpu[0], s.cpu[1], s.cpu[2]);
+    if (s.gpu[0] >= 0)
+    {
+        printf(" | gpu p50 %.2f ms, p95 %.2f ms, p99 %.2f ms", s.gpu[0], s.gpu[1], s.gpu[2]);
+    }
+    printf("\n");
+}
+
+void stop_profiling()
+{
+    print_profile();
+    Profile.set_enabled(false);
+    if (Profile.write_trace(trace_path))
+    {
+        printf("Trace written to %s\n", trace_path);
     }
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    ProfileZone zone(Profile, "key_callback");
+    record_input(InputEvent::Key, key, scancode, action, mods);
+
+    flush_cursor_motion(window);
+
+    // Whether the key changed what is drawn
+    bool changed = false;
+
     // Update the position of the first vertex if the keys 1,2, or 3 are pressed
     switch (key) {
     case GLFW_KEY_I:
@@ -382,8 +883,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             double x, y;
             getWorldPos(window, x, y);
             findselectedtriangle(x, y);
-            current_x = x;
-            current_y = y;
+            drag_cursor = Eigen::Vector2f(x, y);
+            changed = true;
         }
         else if (triangle_selected && action == GLFW_RELEASE)
         {
@@ -399,6 +900,7 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             triangle_selected_index = -1;
             findselectedtriangle(x, y);
             removeselectedtriangle();
+            changed = true;
         }
         else
         {
@@ -406,108 +908,35 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         }
         break;
     case GLFW_KEY_H:
-        //triangle rotate mode
+        // rotate counterclockwise
         if (action == GLFW_PRESS)
         {
-            for (int i = 0; i <= num_Triangles; i++)
-            {
-                int pos_0 = i * 3 + 0;
-                int pos_1 = i * 3 + 1;
-                int pos_2 = i * 3 + 2;
-
-                double center_x = (V.coeff(0, pos_0) + V.coeff(0, pos_1) + V.coeff(0, pos_2)) / 3;
-                double center_y = (V.coeff(1, pos_0) + V.coeff(1, pos_1) + V.coeff(1, pos_2)) / 3;
-
-                const float pi = 3.142;
-                const float theta = (10 * 3.142) / 180;
-
-                double r_x0 = (V.coeff(0, pos_0) - center_x) * std::cos(theta) - (V.coeff(1, pos_0) - center_y) * std::sin(theta);
-                double r_y0 = (V.coeff(0, pos_0) - center_x) * std::sin(theta) + (V.coeff(1, pos_0) - center_y) * std::cos(theta);
-
-                double r_x1 = (V.coeff(0, pos_1) - center_x) * std::cos(theta) - (V.coeff(1, pos_1) - center_y) * std::sin(theta);
-                double r_y1 = (V.coeff(0, pos_1) - center_x) * std::sin(theta) + (V.coeff(1, pos_1) - center_y) * std::cos(theta);
-
-                double r_x2 = (V.coeff(0, pos_2) - center_x) * std::cos(theta) - (V.coeff(0, pos_2) - center_x) * std::sin(theta);
-                double r_y2 = (V.coeff(0, pos_2) - center_x) * std::sin(theta) + (V.coeff(0, pos_2) - center_x) * std::cos(theta);
-
-                V.col(pos_0) << center_x + r_x0, center_y + r_y0, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_1) << center_x + r_x1, center_y + r_y1, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_2) << center_x + r_x2, center_y + r_y2, 1.0, 1.0, 0.0, 0.0;
-            }
-            VBO.update(V);
+            transform_selection(TriangleTransform::rotation(10 * pi / 180));
+            changed = true;
         }
         break;
     case GLFW_KEY_J:
-        // triangle rotate mode
-        //triangle rotate mode
+        // rotate clockwise
         if (action == GLFW_PRESS)
         {
-            for (int i = 0; i <= num_Triangles; i++)
-            {
-                int pos_0 = i * 3 + 0;
-                int pos_1 = i * 3 + 1;
-                int pos_2 = i * 3 + 2;
-
-                double center_x = (V.coeff(0, pos_0) + V.coeff(0, pos_1) + V.coeff(0, pos_2)) / 3;
-                double center_y = (V.coeff(1, pos_0) + V.coeff(1, pos_1) + V.coeff(1, pos_2)) / 3;
-
-                const float pi = 3.142;
-                const float theta = (-10 * 3.142) / 180;
-
-                double r_x0 = (V.coeff(0, pos_0) - center_x) * std::cos(theta) - (V.coeff(1, pos_0) - center_y) * std::sin(theta);
-                double r_y0 = (V.coeff(0, pos_0) - center_x) * std::sin(theta) + (V.coeff(1, pos_0) - center_y) * std::cos(theta);
-
-                double r_x1 = (V.coeff(0, pos_1) - center_x) * std::cos(theta) - (V.coeff(1, pos_1) - center_y) * std::sin(theta);
-                double r_y1 = (V.coeff(0, pos_1) - center_x) * std::sin(theta) + (V.coeff(1, pos_1) - center_y) * std::cos(theta);
-
-                double r_x2 = (V.coeff(0, pos_2) - center_x) * std::cos(theta) - (V.coeff(0, pos_2) - center_x) * std::sin(theta);
-                double r_y2 = (V.coeff(0, pos_2) - center_x) * std::sin(theta) + (V.coeff(0, pos_2) - center_x) * std::cos(theta);
-
-                V.col(pos_0) << center_x + r_x0, center_y + r_y0, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_1) << center_x + r_x1, center_y + r_y1, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_2) << center_x + r_x2, center_y + r_y2, 1.0, 1.0, 0.0, 0.0;
-            }
-            VBO.update(V);
+            transform_selection(TriangleTransform::rotation(-10 * pi / 180));
+            changed = true;
         }
         break;
     case GLFW_KEY_K:
-        //enable scale mode
+        // scale up
         if (action == GLFW_PRESS)
         {
-            for (int i = 0; i <= num_Triangles; i++)
-            {
-                int pos_0 = i * 3 + 0;
-                int pos_1 = i * 3 + 1;
-                int pos_2 = i * 3 + 2;
-
-                double center_x = (V.coeff(0, pos_0) + V.coeff(0, pos_1) + V.coeff(0, pos_2)) / 3;
-                double center_y = (V.coeff(1, pos_0) + V.coeff(1, pos_1) + V.coeff(1, pos_2)) / 3;
-
-                V.col(pos_0) << V.coeff(0, pos_0) + (V.coeff(0, pos_0) - center_x)* 0.25, V.coeff(1, pos_0) + (V.coeff(1, pos_0) - center_y)* 0.25, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_1) << V.coeff(0, pos_1) + (V.coeff(0, pos_1) - center_x)* 0.25, V.coeff(1, pos_1) + (V.coeff(1, pos_1) - center_y)* 0.25, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_2) << V.coeff(0, pos_2) + (V.coeff(0, pos_2) - center_x)* 0.25, V.coeff(1, pos_2) + (V.coeff(1, pos_2) - center_y)* 0.25, 1.0, 1.0, 0.0, 0.0;
-            }
-            VBO.update(V);
+            transform_selection(TriangleTransform::scaling(1.25f));
+            changed = true;
         }
         break;
     case GLFW_KEY_L:
-        //enable scale mode
+        // scale down
         if (action == GLFW_PRESS)
         {
-            for (int i = 0; i <= num_Triangles; i++)
-            {
-                int pos_0 = i * 3 + 0;
-                int pos_1 = i * 3 + 1;
-                int pos_2 = i * 3 + 2;
-
-                double center_x = (V.coeff(0, pos_0) + V.coeff(0, pos_1) + V.coeff(0, pos_2)) / 3;
-                double center_y = (V.coeff(1, pos_0) + V.coeff(1, pos_1) + V.coeff(1, pos_2)) / 3;
-
-                V.col(pos_0) << V.coeff(0, pos_0) - (V.coeff(0, pos_0) - center_x)* 0.25, V.coeff(1, pos_0) - (V.coeff(1, pos_0) - center_y)* 0.25, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_1) << V.coeff(0, pos_1) - (V.coeff(0, pos_1) - center_x)* 0.25, V.coeff(1, pos_1) - (V.coeff(1, pos_1) - center_y)* 0.25, 1.0, 1.0, 0.0, 0.0;
-                V.col(pos_2) << V.coeff(0, pos_2) - (V.coeff(0, pos_2) - center_x)* 0.25, V.coeff(1, pos_2) - (V.coeff(1, pos_2) - center_y)* 0.25, 1.0, 1.0, 0.0, 0.0;
-            }
-            VBO.update(V);
+            transform_selection(TriangleTransform::scaling(0.75f));
+            changed = true;
         }
         break;
     case GLFW_KEY_C:
@@ -588,215 +1017,364 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         if (apply_shader_translation && action == GLFW_RELEASE)
         {
             apply_shader_translation = false;
+            changed = true;
         }
         else if (!apply_shader_translation && action == GLFW_RELEASE)
         {
             apply_shader_translation = true;
+            changed = true;
         }
         break;
     case GLFW_KEY_F:
         //key frames
         if(action == GLFW_PRESS)
         {
-            //count the number of frames user wish to create.
+            // animate the triangle under the cursor, its drags record key frames
             triangle_selected = true;
             triangle_selected_index = -1;
             double x, y;
             getWorldPos(window, x, y);
             findselectedtriangle(x, y);
-            current_x = x;
-            current_y = y;
-            selected_triangle_animation = triangle_selected_index;
-            key_frames_count++;
+            drag_cursor = Eigen::Vector2f(x, y);
+            if (triangle_selected_index != -1)
+            {
+                Keyframes.add(Triangles, triangle_selected_index);
+            }
             animation_on = true;
+            changed = true;
         }
         break;
     case GLFW_KEY_N:
-        //perform animation linear interpolation
-        if(action == GLFW_PRESS)
+        // play the animation with linear interpolation, or pause it
+        if (action == GLFW_PRESS && Keyframes.size() > 0)
         {
-            //update current primitive postion by a constant factor(0.01) after every 33ms(30fps)
-            for(int i = 0; i<key_frames_count; i++){
-                int num_frames = -1;//devide the movement between two frames for smoothness.
-                double x1_current = Key_frame_pos(0, ((i+1) * 3) + 0);
-                double x2_current = Key_frame_pos(0, ((i+1) * 3) + 1);
-                double x3_current = Key_frame_pos(0, ((i+1) * 3) + 2);
-                double y1_current = Key_frame_pos(1, ((i+1) * 3) + 0);
-                double y2_current = Key_frame_pos(1, ((i+1) * 3) + 1);
-                double y3_current = Key_frame_pos(1, ((i+1) * 3) + 2);
-                while((num_frames < 11)){
-                    ++num_frames;
-                    double x1 = Key_frame_pos(0, (i * 3) + 0)+((x1_current - (Key_frame_pos(0, (i * 3) + 0)))*(0.1 * num_frames));
-                    double x2 = Key_frame_pos(0, (i * 3) + 1)+((x2_current - (Key_frame_pos(0, (i * 3) + 1)))*(0.1 * num_frames));
-                    double x3 = Key_frame_pos(0, (i * 3) + 2)+((x3_current - (Key_frame_pos(0, (i * 3) + 2)))*(0.1 * num_frames));
-
-                    double y1 = Key_frame_pos(1, (i * 3) + 0)+((y1_current - (Key_frame_pos(1, (i * 3) + 0)))*(0.1 * num_frames));
-                    double y2 = Key_frame_pos(1, (i * 3) + 1)+((y2_current - (Key_frame_pos(1, (i * 3) + 1)))*(0.1 * num_frames));
-                    double y3 = Key_frame_pos(1, (i * 3) + 2)+((y3_current - (Key_frame_pos(1, (i * 3) + 2)))*(0.1 * num_frames));
-
-                    V.col((selected_triangle_animation * 3) + 0) << x1, y1, V.coeff(2, (selected_triangle_animation * 3) + 0), 0.0, 0.0, 1.0;
-                    V.col((selected_triangle_animation * 3) + 1) << x2, y2, V.coeff(2, (selected_triangle_animation * 3) + 1), 0.0, 0.0, 1.0;
-                    V.col((selected_triangle_animation * 3) + 2) << x3, y3, V.coeff(2, (selected_triangle_animation * 3) + 2), 0.0, 0.0, 1.0;
-                    //wait for 33ms
-                    std::this_thread::sleep_for(std::chrono::milliseconds(33));
-                    VBO.update(V);
-                    draw_triangle(window);
-                }
-            }
+            play_animation(KeyframeStore::Linear);
+            changed = true;
         }
         break;
     case GLFW_KEY_B:
-        //perform animation Quadratic Bézier curves around a predefined fixed point.
+        // play the animation along smooth Catmull-Rom splines through the key frames, or pause it
+        if (action == GLFW_PRESS && Keyframes.size() > 0)
+        {
+            play_animation(KeyframeStore::CatmullRom);
+            changed = true;
+        }
+        break;
+    case GLFW_KEY_E:
+        // export the triangles and their key frames for the offline renderer
+        if (action == GLFW_PRESS && save_scene("scene.txt", Triangles, num_Triangles, Keyframes, Camera.view() * mat_Transform))
+        {
+            printf("Scene saved to scene.txt\n");
+        }
+        break;
+    case GLFW_KEY_G:
+        // play from the baked samples of the key frames, or from the curves again
         if (action == GLFW_PRESS)
         {
-            const double pivot_x = 0.5;
-            const double pivot_y = 0.5;
-            for (int i = 0; i < key_frames_count; i++)
+            bake_on = !bake_on;
+            if (!bake_on)
             {
-                int num_frames = -1;//devide the movement between two frames for smoothness.
-                double x1_current = Key_frame_pos(0, ((i + 1) * 3) + 0);
-                double x2_current = Key_frame_pos(0, ((i + 1) * 3) + 1);
-                double x3_current = Key_frame_pos(0, ((i + 1) * 3) + 2);
-                double y1_current = Key_frame_pos(1, ((i + 1) * 3) + 0);
-                double y2_current = Key_frame_pos(1, ((i + 1) * 3) + 1);
-                double y3_current = Key_frame_pos(1, ((i + 1) * 3) + 2);
-
-                while ((num_frames < 11)) {
-                    ++num_frames;
-                    float t = (0.1 * num_frames);
-                    double A_x1 = (1 - t) * ((1 - t)*Key_frame_pos(0, (i * 3) + 0) + t * pivot_x);
-                    double B_x1 = t*((1 - t)*pivot_x + t * Key_frame_pos(0, ((i + 1) * 3) + 0));
-                    double x1 = A_x1 + B_x1;
-
-                    double A_x2 = (1 - t) * ((1 - t)*Key_frame_pos(0, (i * 3) + 1) + t * pivot_x);
-                    double B_x2 = t*((1 - t)*pivot_x + t * Key_frame_pos(0, ((i + 1) * 3) + 1));
-                    double x2 = A_x2 + B_x2;
-
-                    double A_x3 = (1 - t) * ((1 - t)*Key_frame_pos(0, (i * 3) + 2) + t * pivot_x);
-                    double B_x3 = t*((1 - t)*pivot_x + t * Key_frame_pos(0, ((i + 1) * 3) + 2));
-                    double x3 = A_x3 + B_x3;
-
-                    double A_y1 = (1 - t) * ((1 - t)*Key_frame_pos(1, (i * 3) + 0) + t * pivot_y);
-                    double B_y1 = t*((1 - t)*pivot_y + t * Key_frame_pos(1, ((i + 1) * 3) + 0));
-                    double y1 = A_y1 + B_y1;
-
-                    double A_y2 = (1 - t) * ((1 - t)*Key_frame_pos(1, (i * 3) + 1) + t * pivot_y);
-                    double B_y2 = t*((1 - t)*pivot_y + t * Key_frame_pos(1, ((i + 1) * 3) + 1));
-                    double y2 = A_y2 + B_y2;
-
-                    double A_y3 = (1 - t) * ((1 - t)*Key_frame_pos(1, (i * 3) + 2) + t * pivot_y);
-                    double B_y3 = t*((1 - t)*pivot_y + t * Key_frame_pos(1, ((i + 1) * 3) + 2));
-                    double y3 = A_y3 + B_y3;
-
-                    V.col((selected_triangle_animation * 3) + 0) << x1, y1, V.coeff(2, (selected_triangle_animation * 3) + 0), 0.0, 0.0, 1.0;
-                    V.col((selected_triangle_animation * 3) + 1) << x2, y2, V.coeff(2, (selected_triangle_animation * 3) + 1), 0.0, 0.0, 1.0;
-                    V.col((selected_triangle_animation * 3) + 2) << x3, y3, V.coeff(2, (selected_triangle_animation * 3) + 2), 0.0, 0.0, 1.0;
-                    //wait for 33ms
-                    std::this_thread::sleep_for(std::chrono::milliseconds(33));
-                    VBO.update(V);
-                    draw_triangle(window);
-                }
+                Baked.clear();
             }
+            if (Keyframes.size() > 0)
+            {
+                apply_animation();
+                changed = true;
+            }
+        }
+        break;
+    case GLFW_KEY_SPACE:
+        // pause / resume the animation
+        if (action == GLFW_PRESS && Keyframes.size() > 0)
+        {
+            Animation.toggle();
+            changed = true;
+        }
+        break;
+    case GLFW_KEY_LEFT:
+    case GLFW_KEY_RIGHT:
+        // scrub the animation one frame backward / forward
+        if (action != GLFW_RELEASE && Keyframes.size() > 0)
+        {
+            Animation.pause();
+            Animation.seek(Animation.current() + (key == GLFW_KEY_LEFT ? -scrub_step : scrub_step));
+            apply_animation();
+            changed = true;
         }
         break;
     case GLFW_KEY_R:
         //reset animation
-        if((key_frames_count != 0) && action == GLFW_PRESS)
+        if (Keyframes.size() > 0 && action == GLFW_PRESS)
         {
-            key_frames_count = 0;
-            V.col((selected_triangle_animation * 3) + 0) << Key_frame_pos(0, (selected_triangle_animation * 3) + 0), Key_frame_pos(1, (selected_triangle_animation * 3) + 0), V.coeff(2, (selected_triangle_animation * 3) + 0), 0.0, 0.0, 1.0;
-            V.col((selected_triangle_animation * 3) + 1) << Key_frame_pos(0, (selected_triangle_animation * 3) + 1), Key_frame_pos(1, (selected_triangle_animation * 3) + 1), V.coeff(2, (selected_triangle_animation * 3) + 1), 0.0, 0.0, 1.0;
-            V.col((selected_triangle_animation * 3) + 2) << Key_frame_pos(0, (selected_triangle_animation * 3) + 2), Key_frame_pos(1, (selected_triangle_animation * 3) + 2), V.coeff(2, (selected_triangle_animation * 3) + 2), 0.0, 0.0, 1.0;
-            selected_triangle_animation = -1;
+            //restore the pose of the first key frame
+            Animation.stop();
+            apply_animation();
+            Keyframes.clear();
+            Baked.clear();
             animation_on = false;
+            changed = true;
         }
         break;
     case GLFW_KEY_KP_ADD:
         if(action == GLFW_PRESS)
         {
-            Eigen::Matrix<float, 3, 3> camPos;
-            Eigen::Vector3f camdirection = Eigen::Vector3f(0.0, 0.0, 1.0);
-            Eigen::Vector3f up = Eigen::Vector3f(0.0, 1.1, 0.0);
-            Eigen::Vector3f camrigh = up.cross(camdirection);
-            Eigen::Vector3f camup = camdirection.cross(camrigh);
-
-            camPos.col(0) << camrigh[0],camrigh[1],camrigh[2];
-            camPos.col(1) << camup[0],camup[1],camup[2];
-            camPos.col(2) << camdirection[0],camdirection[1],camdirection[2];
-            mat_View = mat_View * camPos;
+            Camera.zoom_by(zoom_step);
+            changed = true;
         }
         break;
     case GLFW_KEY_MINUS:
         if(action == GLFW_PRESS)
         {
-            Eigen::Matrix<float, 3, 3> camPos;
-            Eigen::Vector3f camdirection = Eigen::Vector3f(0.0, 0.0, 1.0);
-            Eigen::Vector3f up = Eigen::Vector3f(0.0, 0.9, 0.0);
-            Eigen::Vector3f camrigh = up.cross(camdirection);
-            Eigen::Vector3f camup = camdirection.cross(camrigh);
-
-            camPos.col(0) << camrigh[0],camrigh[1],camrigh[2];
-            camPos.col(1) << camup[0],camup[1],camup[2];
-            camPos.col(2) << camdirection[0],camdirection[1],camdirection[2];
-            mat_View = mat_View * camPos;
+            Camera.zoom_by(1 / zoom_step);
+            changed = true;
         }
         break;
     case GLFW_KEY_W:
         if(action == GLFW_PRESS)
         {
-            Eigen::Matrix<float, 3, 3> camPos;
-
-            camPos.col(0) << 0,0, 0;
-            camPos.col(1) << 0,0, 0;
-            camPos.col(2) << 0,0.1, 0;
-            mat_View = mat_View + camPos;
+            Camera.pan(Eigen::Vector2f(0, pan_step));
+            changed = true;
+        }
+        break;
+    case GLFW_KEY_Z:
+        // undo the last edit, Ctrl+Shift+Z redoes it
+        if (action != GLFW_RELEASE && (mods & GLFW_MOD_CONTROL))
+        {
+            if (mods & GLFW_MOD_SHIFT)
+            {
+                redo_edit();
+            }
+            else
+            {
+                undo_edit();
+            }
+            changed = true;
+        }
+        break;
+    case GLFW_KEY_Y:
+        // redo the last undone edit
+        if (action != GLFW_RELEASE && (mods & GLFW_MOD_CONTROL))
+        {
+            redo_edit();
+            changed = true;
+        }
+        break;
+    case GLFW_KEY_F9:
+        // start profiling the frames, or stop and write the trace
+        if (action == GLFW_PRESS)
+        {
+            if (Profile.enabled())
+            {
+                stop_profiling();
+            }
+            else
+            {
+                Profile.set_enabled(true);
+                printf("Profiling, press F9 again to write %s\n", trace_path);
+            }
         }
         break;
     case GLFW_KEY_S:
-        if(action == GLFW_PRESS)
+        // save the committed triangles and their key frames
+        if (action == GLFW_PRESS && (mods & GLFW_MOD_CONTROL))
         {
-            Eigen::Matrix<float, 3, 3> camPos;
-
-            camPos.col(0) << 0,0, 0;
-            camPos.col(1) << 0,0, 0;
-            camPos.col(2) << 0,-0.1, 0;
-
-            mat_View =  mat_View + camPos;
+            if (save_scene_file(scene_path, Triangles, num_Triangles, Keyframes, Camera.view()))
+            {
+                printf("Scene saved to %s\n", scene_path.c_str());
+            }
+        }
+        else if(action == GLFW_PRESS)
+        {
+            Camera.pan(Eigen::Vector2f(0, -pan_step));
+            changed = true;
         }
         break;
     case GLFW_KEY_A:
         if(action == GLFW_PRESS)
         {
-            Eigen::Matrix<float, 3, 3> camPos;
-
-            camPos.col(0) << 0,0, 0;
-            camPos.col(1) << 0,0, 0;
-            camPos.col(2) << -0.1,0, 0;
-
-            mat_View =  mat_View + camPos;
+            Camera.pan(Eigen::Vector2f(-pan_step, 0));
+            changed = true;
         }
         break;
     case GLFW_KEY_D:
         if(action == GLFW_PRESS)
         {
-            Eigen::Matrix<float, 3, 3> camPos;
-
-            camPos.col(0) << 0,0, 0;
-            camPos.col(1) << 0,0, 0;
-            camPos.col(2) << 0.1,0, 0;
-
-            mat_View =  mat_View + camPos;
+            Camera.pan(Eigen::Vector2f(pan_step, 0));
+            changed = true;
         }
         break;
     default:
         break;
     }
 
+    // Paint the vertex picked in color mode
+    if (color_change && action == GLFW_RELEASE && key >= GLFW_KEY_1 && key <= GLFW_KEY_9 &&
+        (triangle_selected_index != -1) && (closer_vertex != -1))
+    {
+        set_vertex_color((triangle_selected_index * 3) + closer_vertex, color);
+        changed = true;
+    }
+
     // Upload the change to the GPU
-    VBO.update(V);
+    if (changed)
+    {
+        upload_triangles();
+        request_redraw();
+    }
+}
+
+// One iteration of the main loop once the events are handled: the pending
+// cursor motion, the animation (advanced by elapsed seconds) and the redraw
+void process_frame(GLFWwindow* window, double elapsed)
+{
+    // Apply the motion events of this iteration at once
+    flush_cursor_motion(window);
+
+    if (Animation.advance(elapsed))
+    {
+        apply_animation();
+    }
+
+    if (redraw_needed)
+    {
+        redraw_needed = false;
+        Profile.begin_frame();
+        draw_triangle(window);
+        Profile.end_frame();
+        // Rolling summary once per window of frames
+        if (Profile.enabled() && Profile.frames() % Profiler::window == 0)
+        {
+            print_profile();
+        }
+    }
 }
 
-int main(void) {
+// Feed the events of log to the callbacks, as fast as possible or at their
+// recorded pace, and report how long each one took to handle. The latency
+// of an event covers its callback and the frame it caused, until the GPU
+// finished drawing it. The animation follows the recorded clock, so a replay
+// as fast as possible goes through the same states as the session.
+void replay_input(GLFWwindow* window, const InputLog &log, bool realtime, const std::string &latency_path)
+{
+    replaying = true;
+    replay_window[0] = log.window[0];
+    replay_window[1] = log.window[1];
+    replay_framebuffer[0] = log.framebuffer[0];
+    replay_framebuffer[1] = log.framebuffer[1];
+    // Frames are not held back by the display refresh
+    if (!realtime)
+    {
+        glfwSwapInterval(0);
+    }
+
+    std::vector<double> latency(log.events.size());
+    double start = glfwGetTime();
+    double last_time = 0;
+    for (size_t i = 0; i < log.events.size() && !glfwWindowShouldClose(window); i++)
+    {
+        const InputEvent &e = log.events[i];
+        if (realtime)
+        {
+            double wait = e.time - (glfwGetTime() - start);
+            if (wait > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+            }
+        }
+        // Only the window events are dispatched, the input callbacks are not
+        // registered while replaying
+        glfwPollEvents();
+
+        double begin = glfwGetTime();
+        switch (e.kind)
+        {
+        case InputEvent::Key:
+            key_callback(window, e.args[0], e.args[1], e.args[2], e.args[3]);
+            break;
+        case InputEvent::MouseButton:
+            mouse_button_callback(window, e.args[0], e.args[1], e.args[2]);
+            break;
+        case InputEvent::CursorPos:
+            replay_cursor[0] = e.x;
+            replay_cursor[1] = e.y;
+            mouse_curson_pos_callback(window, e.x, e.y);
+            break;
+        case InputEvent::Resize:
+            replay_window[0] = e.args[0];
+            replay_window[1] = e.args[1];
+            replay_framebuffer[0] = e.args[2];
+            replay_framebuffer[1] = e.args[3];
+            framebuffer_size_callback(window, e.args[2], e.args[3]);
+            break;
+        }
+        process_frame(window, e.time - last_time);
+        glFinish();
+        latency[i] = glfwGetTime() - begin;
+        last_time = e.time;
+    }
+    replaying = false;
+
+    printf("Replayed %zu events in %.3f s (recorded in %.3f s)\n", log.events.size(), glfwGetTime() - start,
+        log.events.empty() ? 0.0 : log.events.back().time);
+    print_input_latency(log, latency);
+    if (!latency_path.empty() && write_input_latency(latency_path, log, latency))
+    {
+        printf("Latencies written to %s\n", latency_path.c_str());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Render a scene to files without opening a window
+    if (argc > 1 && std::string(argv[1]) == "--render")
+    {
+        return render_offline(argc - 2, argv + 2);
+    }
+
+    // assignment5 [--record <log> | --replay <log> [--realtime] [--latency <csv>]] [scene]
+    std::string record_path, replay_path, latency_path, scene_arg;
+    bool realtime = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--record" && has_value)
+        {
+            record_path = argv[++i];
+        }
+        else if (arg == "--replay" && has_value)
+        {
+            replay_path = argv[++i];
+        }
+        else if (arg == "--latency" && has_value)
+        {
+            latency_path = argv[++i];
+        }
+        else if (arg == "--realtime")
+        {
+            realtime = true;
+        }
+        else if (arg.compare(0, 2, "--") != 0 && scene_arg.empty())
+        {
+            scene_arg = arg;
+        }
+        else
+        {
+            printf("Usage: assignment5 [--record <log> | --replay <log> [--realtime] [--latency <csv>]] [scene]\n"
+                "       assignment5 --render <scene> <output> [options]\n");
+            return 2;
+        }
+    }
+    InputLog input;
+    if (!replay_path.empty() && !record_path.empty())
+    {
+        printf("A session cannot be recorded while replaying one\n");
+        return 2;
+    }
+    if (!replay_path.empty() && !load_input_log(replay_path, input))
+    {
+        return 1;
+    }
+
     // Initialize the GLFW library
     if (!glfwInit()) {
         return -1;
@@ -825,6 +1403,9 @@ int main(void) {
     // Make the window's context current
     glfwMakeContextCurrent(window);
 
+    // Present at most one frame per display refresh
+    glfwSwapInterval(1);
+
     // Load OpenGL and its extensions
     if (!gladLoadGL()) {
         printf("Failed to load OpenGL and its extensions");
@@ -840,114 +1421,249 @@ int main(void) {
     printf("Supported OpenGL is %s\n", (const char*)glGetString(GL_VERSION));
     printf("Supported GLSL is %s\n", (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
 
-    // Register the keyboard callback
-    glfwSetKeyCallback(window, key_callback);
+    // A replay gets its input from the log only
+    if (replay_path.empty())
+    {
+        // Register the keyboard callback
+        glfwSetKeyCallback(window, key_callback);
 
-    // Register the mouse callback
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
+        // Register the mouse callback
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
 
-    //Register the cursor positon callback
-    glfwSetCursorPosCallback(window, mouse_curson_pos_callback);
+        //Register the cursor positon callback
+        glfwSetCursorPosCallback(window, mouse_curson_pos_callback);
+    }
+
+    // Redraw when the window is resized or exposed
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
     init();
 
+    // Open the scene given on the command line, Ctrl+S saves back to it.
+    // Triangle soups of other tools are imported instead.
+    if (!scene_arg.empty() && importable(scene_arg))
+    {
+        import_scene(scene_arg);
+    }
+    else if (!scene_arg.empty())
+    {
+        scene_path = scene_arg;
+        open_scene(scene_path);
+    }
+
+    // The session starts once the scene is loaded, a replay needs the same scene
+    if (!replay_path.empty())
+    {
+        replay_input(window, input, realtime, latency_path);
+        glfwSetWindowShouldClose(window, GL_TRUE);
+    }
+    else if (!record_path.empty())
+    {
+        int window_size[2], framebuffer_size[2];
+        glfwGetWindowSize(window, &window_size[0], &window_size[1]);
+        glfwGetFramebufferSize(window, &framebuffer_size[0], &framebuffer_size[1]);
+        Recorder.open(record_path, window_size, framebuffer_size);
+        record_start = glfwGetTime();
+    }
+
+    double last_time = glfwGetTime();
+
     // Loop until the user closes the window
     while (!glfwWindowShouldClose(window)) {
+        // Sleep until the next event when nothing needs to be drawn
+        if (redraw_needed || Animation.is_playing())
+        {
+            glfwPollEvents();
+        }
+        else
+        {
+            glfwWaitEvents();
+        }
 
-        draw_triangle(window);
-        // Poll for and process events
-        glfwPollEvents();
+        // Advance the animation by the time elapsed since the previous iteration
+        double now = glfwGetTime();
+        process_frame(window, now - last_time);
+        last_time = now;
+    }
+
+    if (Recorder.is_open() && Recorder.close())
+    {
+        printf("Input written to %s\n", record_path.c_str());
+    }
+
+    if (Profile.enabled())
+    {
+        stop_profiling();
     }
 
     // Deallocate opengl memory
+    Profile.free();
     program.free();
     VAO.free();
     VBO.free();
+    VBO_color.free();
+    VBO_state.free();
+    Transform_texture.free();
+    Visible_indices.free();
+    VBO_transform.free();
 
     // Deallocate glfw internals
     glfwTerminate();
     return 0;
 }
 
-double dot(double x1, double y1, double x2, double y2) {
-    return(x1*x2 + y1*y2);
-}
-
 void findselectedtriangle(double x, double y)
 {
-    for (int i = 0; i < num_Triangles; i++)
-    {
-        int pos_0 = i * 3 + 0;
-        int pos_1 = i * 3 + 1;
-        int pos_2 = i * 3 + 2;
+    ProfileZone zone(Profile, "findselectedtriangle");
 
-        double v0_x = V.coeff(0, pos_2) - V.coeff(0, pos_0);
-        double v0_y = V.coeff(1, pos_2) - V.coeff(1, pos_0);
+    // Topmost triangle under the point, the previous selection is kept if there is none
+    int picked = Grid.pick(Triangles, x, y);
+    if (picked != -1)
+    {
+        triangle_selected_index = picked;
+    }
+}
 
-            double v1_x = V.coeff(0, pos_1) - V.coeff(0, pos_0);
-        double v1_y = V.coeff(1, pos_1) - V.coeff(1, pos_0);
+void findclosestvertex(double x, double y)
+{
+    ProfileZone zone(Profile, "findclosestvertex");
 
-        double v2_x = x - V.coeff(0, pos_0);
-        double v2_y = y - V.coeff(1, pos_0);
+    // Closest vertex of the whole scene within the pick radius
+    int v = Vertex_grid.nearest(Triangles, x, y, vertex_pick_radius / Camera.zoom());
+    if (v == -1)
+    {
+        triangle_selected_index = -1;
+        closer_vertex = -1;
+    }
+    else
+    {
+        triangle_selected_index = v / 3;
+        closer_vertex = v % 3;
+    }
+}
 
-        double dot00 = dot(v0_x, v0_y, v0_x, v0_y);
-        double dot01 = dot(v0_x, v0_y, v1_x, v1_y);
-        double dot02 = dot(v0_x, v0_y, v2_x, v2_y);
-        double dot11 = dot(v1_x, v1_y, v1_x, v1_y);
-        double dot12 = dot(v1_x, v1_y, v2_x, v2_y);
+// Triangles [begin, end) took other slots of the store, all their streams are
+// sent with the next upload. Their positions are the current ones, so the
+// motion of their transforms is dropped.
+void invalidate_slots(int begin, int end)
+{
+    for (int t = begin; t < end; t++)
+    {
+        Triangles.reset_transform(t);
+    }
+    VBO.invalidate(begin * 3, (end - begin) * 3);
+    VBO_color.invalidate(begin * 3, (end - begin) * 3);
+    VBO_state.invalidate(begin * 3, (end - begin) * 3);
+    VBO_transform.invalidate(begin, end - begin);
+}
 
-        double invdenom = 1 / (dot00 * dot11 - dot01 * dot01);
-        double u = (dot11 * dot02 - dot01 * dot12) * invdenom;
-        double v = (dot00 * dot12 - dot01 * dot02) * invdenom;
+// Remove committed triangle t. The triangles after it (including one that is
+// still being inserted) move down by one, so the drawing order is kept.
+void delete_triangle(int t)
+{
+    set_highlight(-1);
+
+    Triangles.erase(t);
+    Grid.erase(t);
+    Vertex_grid.erase(t);
+    Keyframes.erase_triangle(t);
+    invalidate_slots(t, Triangles.size());
+    num_Triangles--;
+    vert_count -= 3;
+}
 
-        if ((u >= 0) && (v >= 0) && (u + v < 1))
-        {
-            triangle_selected_index = i;
-        }
+// Inverse of delete_triangle: the triangle recorded by e is inserted back at
+// its index, with the key frames it had when it was removed
+void restore_triangle(const Edit &e)
+{
+    set_highlight(-1);
+
+    Eigen::Matrix<float, 2, 3> v = e.vertices();
+    Triangles.insert(e.first, v.col(0), v.col(1), v.col(2), e.vertex_color(0));
+    Triangles.colors.col(e.first * 3 + 1) = e.vertex_color(1);
+    Triangles.colors.col(e.first * 3 + 2) = e.vertex_color(2);
+    Grid.insert(Triangles, e.first);
+    Vertex_grid.insert(Triangles, e.first);
+    Keyframes.insert_triangle(e.first);
+    if (!e.keys.empty())
+    {
+        Keyframes.restore(e.first, e.keys.data());
     }
+    num_Triangles++;
+    vert_count += 3;
+    index_triangles(num_Triangles);
+    invalidate_slots(e.first, Triangles.size());
+}
 
-    if (color_change)
+void removeselectedtriangle()
+{
+    if (triangle_selected_index == -1)
     {
-        int pos_0 = triangle_selected_index * 3 + 0;
-        int pos_1 = triangle_selected_index * 3 + 1;
-        int pos_2 = triangle_selected_index * 3 + 2;
+        return;
+    }
 
-        // Given the two points (x1, y1) and (x2, y2), the distance d between these points is given by the formula:
-        // d = sqrt((x2-x1)^2 + (y2-y1)^2)
-        double dist_1 = std::sqrt(std::pow((V.coeff(0, pos_0) - (x)),2) + std::pow(((V.coeff(1, pos_0)) - (y)), 2));
-        double dist_2 = std::sqrt(std::pow((V.coeff(0, pos_1) - (x)), 2) + std::pow(((V.coeff(1, pos_1)) - (y)), 2));
-        double dist_3 = std::sqrt(std::pow((V.coeff(0, pos_2) - (x)), 2) + std::pow(((V.coeff(1, pos_2)) - (y)), 2));
+    History.record(Edit::remove(Triangles, Keyframes, triangle_selected_index));
+    delete_triangle(triangle_selected_index);
+    triangle_selected_index = -1;
 
-        double temp = dist_1;
-        closer_vertex = 0;
+    upload_triangles();
+}
 
-        if (dist_2 < temp)
+// Apply edit e again (redo), or revert it (undo)
+void apply_edit(Edit &e, bool revert)
+{
+    switch (e.kind)
+    {
+    case Edit::Insert:
+    case Edit::Delete:
+        if ((e.kind == Edit::Insert) == revert)
         {
-            temp = dist_2;
-            closer_vertex = 1;
+            // It may have been animated since the edit was recorded
+            History.save_keys(e, Keyframes);
+            delete_triangle(e.first);
         }
-        if (dist_3 < temp)
+        else
         {
-            temp = dist_3;
-            closer_vertex = 2;
+            restore_triangle(e);
         }
+        break;
+    case Edit::Transform:
+    {
+        // Only the transforms of the triangles are sent, as for the edit itself
+        TriangleTransform m = revert ? e.matrix().inverse() : e.matrix();
+        transform_triangles(Triangles, e.first, e.last, m, &Workers);
+        invalidate_transforms(e.first, e.last);
+        break;
     }
+    case Edit::Recolor:
+        Triangles.colors.col(e.first) = Eigen::Map<const Eigen::Vector3f>(revert ? e.color.before : e.color.after);
+        VBO_color.invalidate(e.first, 1);
+        break;
+    }
+    upload_triangles();
+    request_redraw();
 }
 
-void removeselectedtriangle()
+// Edits are only undone between two operations: not while a triangle is being
+// inserted or dragged
+bool can_edit_history()
 {
-    int pos_0 = triangle_selected_index * 3 + 0;
-    int pos_1 = triangle_selected_index * 3 + 1;
-    int pos_2 = triangle_selected_index * 3 + 2;
+    return vert_count == num_Triangles * 3 && !mouse_move_flag && !Animation.is_playing();
+}
 
-    for (int i = triangle_selected + 1; i <= num_Triangles; i++)
+void undo_edit()
+{
+    if (History.can_undo() && can_edit_history())
+    {
+        apply_edit(History.undo(), true);
+    }
+}
+
+void redo_edit()
+{
+    if (History.can_redo() && can_edit_history())
     {
-        int nextpos_0 = i * 3 + 0;
-        int nextpos_1 = i * 3 + 1;
-        int nextpos_2 = i * 3 + 2;
-        V.col(pos_0) << V.coeff(0, nextpos_0), V.coeff(1, nextpos_0), 1.0, 1.0, 0.0, 0.0;
-        V.col(pos_1) << V.coeff(0, nextpos_1), V.coeff(1, nextpos_1), 1.0, 1.0, 0.0, 0.0;
-        V.col(pos_2) << V.coeff(0, nextpos_2), V.coeff(1, nextpos_2), 1.0, 1.0, 0.0, 0.0;
+        apply_edit(History.redo(), false);
     }
-    VBO.update(V);
 }
@@ -0,0 +1,309 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "offline.h"
+#include "scene_io.h"
+#include "scene_file.h"
+#include "rasterizer.h"
+#include "keyframes.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Options {
+	std::string scene;
+	std::string output;
+	int width;
+	int height;
+	double fps;
+	double start;
+	// Negative up to the last key
+	double duration;
+};
+
+bool ends_with(const std::string &s, const char *suffix) {
+	size_t n = std::strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool parse_options(int argc, char *argv[], Options &options) {
+	options.width = 640;
+	options.height = 480;
+	options.fps = 30;
+	options.start = 0;
+	options.duration = -1;
+
+	std::vector<std::string> positional;
+	for (int i = 0; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--size" && has_value) {
+			if (std::sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2) {
+				return false;
+			}
+		} else if (arg == "--fps" && has_value) {
+			options.fps = std::atof(argv[++i]);
+		} else if (arg == "--start" && has_value) {
+			options.start = std::atof(argv[++i]);
+		} else if (arg == "--duration" && has_value) {
+			options.duration = std::atof(argv[++i]);
+		} else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-') {
+			return false;
+		} else {
+			positional.push_back(arg);
+		}
+	}
+	if (positional.size() != 2 || options.width <= 0 || options.height <= 0 || options.fps <= 0) {
+		return false;
+	}
+	options.scene = positional[0];
+	options.output = positional[1];
+	return true;
+}
+
+// Split the frame name pattern around its only conversion, %d or %0Nd (the
+// number padded with zeros to N digits). Anything else is rejected, the
+// pattern is never given to printf.
+bool parse_pattern(const std::string &pattern, std::string &prefix, int &digits, std::string &suffix) {
+	size_t percent = pattern.find('%');
+	if (percent == std::string::npos) {
+		return false;
+	}
+	size_t i = percent + 1;
+	digits = 0;
+	if (i < pattern.size() && pattern[i] == '0') {
+		for (++i; i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9' && digits < 100; ++i) {
+			digits = digits * 10 + (pattern[i] - '0');
+		}
+		if (digits == 0 || digits > 32) {
+			return false;
+		}
+	}
+	if (i >= pattern.size() || pattern[i] != 'd' || pattern.find('%', i) != std::string::npos) {
+		return false;
+	}
+	prefix = pattern.substr(0, percent);
+	suffix = pattern.substr(i + 1);
+	return true;
+}
+
+// Destination of the frames: numbered PPM images or a Y4M stream
+class FrameWriter {
+public:
+	FrameWriter() : digits(0), stream(NULL), frames(0) { }
+	~FrameWriter() { close(); }
+
+	bool open(const Options &options) {
+		pattern = options.output;
+		if (!(ends_with(pattern, ".y4m") || pattern == "-")) {
+			if (!parse_pattern(pattern, prefix, digits, suffix)) {
+				std::cerr << pattern << ": the output pattern needs one frame number, %d or %0Nd (such as %04d)"
+					<< std::endl;
+				return false;
+			}
+			return true;
+		}
+		stream = pattern == "-" ? stdout : std::fopen(pattern.c_str(), "wb");
+		if (!stream) {
+			std::cerr << pattern << ": cannot write the stream" << std::endl;
+			return false;
+		}
+		// Frame rate as a fraction with a millisecond precision
+		std::fprintf(stream, "YUV4MPEG2 W%d H%d F%ld:1000 Ip A1:1 C420jpeg\n", options.width, options.height,
+			std::lround(options.fps * 1000));
+		return true;
+	}
+
+	bool write(const Framebuffer &frame) {
+		bool ok = stream ? write_y4m(frame) : write_ppm(frame);
+		++frames;
+		return ok;
+	}
+
+	void close() {
+		if (stream && stream != stdout) {
+			std::fclose(stream);
+		}
+		stream = NULL;
+	}
+
+private:
+	std::string pattern;
+	// PPM frames are named prefix, number padded to digits, suffix
+	std::string prefix;
+	int digits;
+	std::string suffix;
+	FILE *stream;
+	int frames;
+	std::vector<unsigned char> buffer;
+
+	bool write_ppm(const Framebuffer &frame) {
+		char number[48];
+		std::snprintf(number, sizeof(number), "%0*d", digits, frames);
+		std::string name = prefix + number + suffix;
+		FILE *file = std::fopen(name.c_str(), "wb");
+		if (!file) {
+			std::cerr << name << ": cannot write the frame" << std::endl;
+			return false;
+		}
+		std::fprintf(file, "P6\n%d %d\n255\n", frame.width(), frame.height());
+		buffer.resize((size_t) frame.width() * 3);
+		bool ok = true;
+		for (int y = 0; y < frame.height() && ok; ++y) {
+			const unsigned char *rgba = (const unsigned char *) frame.row(y);
+			for (int x = 0; x < frame.width(); ++x) {
+				std::memcpy(&buffer[x * 3], rgba + x * 4, 3);
+			}
+			ok = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+		}
+		ok = std::fclose(file) == 0 && ok;
+		if (!ok) {
+			std::cerr << name << ": cannot write the frame" << std::endl;
+		}
+		return ok;
+	}
+
+	// Full range BT.601 (as in JPEG), chroma averaged over 2x2 pixels
+	bool write_y4m(const Framebuffer &frame) {
+		const int w = frame.width(), h = frame.height();
+		const int cw = (w + 1) / 2, ch = (h + 1) / 2;
+		buffer.resize((size_t) w * h + 2 * (size_t) cw * ch);
+		unsigned char *luma = buffer.data();
+		unsigned char *cb = luma + (size_t) w * h, *cr = cb + (size_t) cw * ch;
+		for (int y = 0; y < h; ++y) {
+			const unsigned char *rgba = (const unsigned char *) frame.row(y);
+			for (int x = 0; x < w; ++x) {
+				const unsigned char *p = rgba + x * 4;
+				luma[(size_t) y * w + x] = (unsigned char) std::lrint(0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]);
+			}
+		}
+		for (int y = 0; y < ch; ++y) {
+			for (int x = 0; x < cw; ++x) {
+				float r = 0, g = 0, b = 0;
+				int n = 0;
+				for (int dy = 0; dy < 2 && y * 2 + dy < h; ++dy) {
+					for (int dx = 0; dx < 2 && x * 2 + dx < w; ++dx, ++n) {
+						const unsigned char *p = (const unsigned char *) (frame.row(y * 2 + dy) + x * 2 + dx);
+						r += p[0];
+						g += p[1];
+						b += p[2];
+					}
+				}
+				r /= n;
+				g /= n;
+				b /= n;
+				float u = 128 - 0.168736f * r - 0.331264f * g + 0.5f * b;
+				float v = 128 + 0.5f * r - 0.418688f * g - 0.081312f * b;
+				cb[(size_t) y * cw + x] = (unsigned char) std::lrint(std::min(std::max(u, 0.0f), 255.0f));
+				cr[(size_t) y * cw + x] = (unsigned char) std::lrint(std::min(std::max(v, 0.0f), 255.0f));
+			}
+		}
+		std::fputs("FRAME\n", stream);
+		if (std::fwrite(buffer.data(), 1, buffer.size(), stream) != buffer.size()) {
+			std::cerr << pattern << ": cannot write the stream" << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
+
+// Everything a thread needs to render one frame of a batch
+// Only the animated triangles differ from one frame to the other, so a slot
+// keeps their vertices and draws the shared store with them
+struct Slot {
+	// Pose of every object, then its vertices in that pose
+	std::vector<KeyframeStore::Affine> poses;
+	Framebuffer frame;
+	Rasterizer rasterizer;
+};
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+int render_offline(int argc, char *argv[]) {
+	Options options;
+	if (!parse_options(argc, argv, options)) {
+		std::cerr << "Usage: assignment5 --render <scene> <output> [--size WxH] [--fps F] [--start S] [--duration D]"
+			<< std::endl;
+		return 2;
+	}
+
+	TriangleStore triangles;
+	KeyframeStore keyframes;
+	Eigen::Matrix3f view;
+	if (ends_with(options.scene, ".ucg")) {
+		SceneFile file;
+		if (!file.open(options.scene)) {
+			return 1;
+		}
+		file.load_triangles(triangles);
+		file.load_keyframes(keyframes);
+		view = file.view();
+	} else if (!load_scene(options.scene, triangles, keyframes, view)) {
+		return 1;
+	}
+
+	double duration = options.duration >= 0 ? options.duration
+		: std::max(0.0, (double) keyframes.end_time() - options.start);
+	int count = (int) std::floor(duration * options.fps + 1e-6) + 1;
+
+	FrameWriter writer;
+	if (!writer.open(options)) {
+		return 1;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point begin = Clock::now();
+
+	// One frame per thread: the poses are evaluated with the whole pool, then
+	// every frame is rasterized on its own thread
+	ThreadPool pool;
+	std::vector<Slot> slots(std::min(pool.size(), count));
+	for (size_t k = 0; k < slots.size(); ++k) {
+		slots[k].frame.resize(options.width, options.height);
+	}
+	// Object animating every triangle, -1 for the static ones
+	std::vector<int> posed(triangles.size(), -1);
+	for (int o = 0; o < keyframes.size(); ++o) {
+		posed[keyframes.triangle(o)] = o;
+	}
+
+	for (int first = 0; first < count; first += (int) slots.size()) {
+		int batch = std::min((int) slots.size(), count - first);
+		for (int k = 0; k < batch; ++k) {
+			float time = (float) (options.start + (first + k) / options.fps);
+			keyframes.evaluate(time, slots[k].poses, &pool);
+		}
+		pool.parallel_for(batch, 1, [&](int from, int to) {
+			for (int k = from; k < to; ++k) {
+				Slot &slot = slots[k];
+				for (int o = 0; o < keyframes.size(); ++o) {
+					slot.poses[o] = keyframes.vertices(o, slot.poses[o]);
+				}
+				slot.frame.clear(1.0f, 1.0f, 1.0f);
+				slot.rasterizer.draw(triangles, 0, triangles.size(), view, slot.frame, posed.data(),
+					slot.poses.data());
+			}
+		});
+		for (int k = 0; k < batch; ++k) {
+			if (!writer.write(slots[k].frame)) {
+				return 1;
+			}
+		}
+	}
+	writer.close();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+	std::cerr << count << " frames of " << triangles.size() << " triangles rendered in " << seconds << " s ("
+		<< count / seconds << " frames/s)" << std::endl;
+	return 0;
+}
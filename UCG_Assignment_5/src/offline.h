@@ -0,0 +1,21 @@
+#pragma once
+
+// Offline rendering of keyframed scenes, without a window or a GPU.
+//
+// Usage: assignment5 --render <scene> <output> [options]
+//
+//   <scene>           text scene (see scene_io.h) or binary .ucg scene
+//                     (see scene_file.h)
+//   <output>          name of the frames with one %d or %0Nd frame number,
+//                     such as frames/%04d.ppm, or a .y4m file (- for the
+//                     standard output)
+//   --size WxH        frame size in pixels (640x480)
+//   --fps F           frames per second (30)
+//   --start S         time of the first frame in seconds (0)
+//   --duration D      length in seconds (up to the last key)
+//
+// Frames are evaluated at a fixed rate and rasterized in parallel by batches,
+// one frame per thread, then written in order.
+
+// Parse the arguments that follow --render and render, returns the exit code
+int render_offline(int argc, char *argv[]);
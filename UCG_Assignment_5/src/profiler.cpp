@@ -0,0 +1,213 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "profiler.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+////////////////////////////////////////////////////////////////////////////////
+
+const double Profiler::percentiles[3] = { 50, 95, 99 };
+
+Profiler::Profiler()
+	: on(false)
+	, timer_queries(false)
+	, gpu_open(false)
+	, frame(0)
+	, frame_start(0)
+{
+	sets[0].used = 0;
+	sets[1].used = 0;
+}
+
+void Profiler::set_enabled(bool enable) {
+	if (enable && !on) {
+		events.clear();
+		open.clear();
+		cpu_times.clear();
+		gpu_times.clear();
+		// Queries issued during a previous recording are never read
+		sets[0].used = 0;
+		sets[1].used = 0;
+		gpu_open = false;
+		frame = 0;
+		origin = Clock::now();
+
+		timer_queries = false;
+#if defined(GL_VERSION_3_3)
+		timer_queries = timer_queries || GLAD_GL_VERSION_3_3;
+#endif
+#if defined(GL_ARB_timer_query)
+		timer_queries = timer_queries || GLAD_GL_ARB_timer_query;
+#endif
+	}
+	on = enable;
+}
+
+void Profiler::begin_frame() {
+	if (!on) {
+		return;
+	}
+	// The queries of this set were issued two frames ago
+	collect(sets[frame & 1]);
+	frame_start = now();
+}
+
+void Profiler::end_frame() {
+	if (!on) {
+		return;
+	}
+	int64_t duration = now() - frame_start;
+	record("frame", frame_start, duration, false);
+	push(cpu_times, duration);
+	++frame;
+}
+
+void Profiler::begin(const char *name) {
+	if (on) {
+		open.push_back(std::make_pair(name, now()));
+	}
+}
+
+void Profiler::end() {
+	// The profiler may have been enabled inside the zone
+	if (!on || open.empty()) {
+		return;
+	}
+	int64_t start = open.back().second;
+	record(open.back().first, start, now() - start, false);
+	open.pop_back();
+}
+
+void Profiler::begin_gpu(const char *name) {
+	if (!on || !timer_queries || gpu_open) {
+		return;
+	}
+#if defined(GL_VERSION_3_3) || defined(GL_ARB_timer_query)
+	QuerySet &set = sets[frame & 1];
+	if (set.used == (int) set.ids.size()) {
+		GLuint id;
+		glGenQueries(1, &id);
+		set.ids.push_back(id);
+		set.names.push_back(NULL);
+		set.starts.push_back(0);
+	}
+	set.names[set.used] = name;
+	set.starts[set.used] = now();
+	glBeginQuery(GL_TIME_ELAPSED, set.ids[set.used]);
+	++set.used;
+	gpu_open = true;
+#else
+	// Timer queries are not in the loaded OpenGL version
+	(void) name;
+#endif
+}
+
+void Profiler::end_gpu() {
+	if (!gpu_open) {
+		return;
+	}
+#if defined(GL_VERSION_3_3) || defined(GL_ARB_timer_query)
+	glEndQuery(GL_TIME_ELAPSED);
+#endif
+	gpu_open = false;
+}
+
+Profiler::Summary Profiler::summary() const {
+	Summary s;
+	s.frames = (int) cpu_times.size();
+	const std::vector<int64_t> *times[2] = { &cpu_times, &gpu_times };
+	double *out[2] = { s.cpu, s.gpu };
+	for (int k = 0; k < 2; ++k) {
+		std::vector<int64_t> sorted = *times[k];
+		std::sort(sorted.begin(), sorted.end());
+		for (int i = 0; i < 3; ++i) {
+			if (sorted.empty()) {
+				out[k][i] = -1;
+				continue;
+			}
+			// Nearest rank
+			size_t rank = (size_t) std::ceil(percentiles[i] / 100 * sorted.size());
+			out[k][i] = sorted[std::max<size_t>(rank, 1) - 1] * 1e-6;
+		}
+	}
+	return s;
+}
+
+bool Profiler::write_trace(const std::string &path) const {
+	FILE *file = std::fopen(path.c_str(), "w");
+	if (!file) {
+		std::cerr << path << ": cannot write the trace" << std::endl;
+		return false;
+	}
+	std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+	std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+	for (size_t i = 0; i < events.size(); ++i) {
+		// Zone names are identifiers of the code, they need no escaping
+		const Event &e = events[i];
+		std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+			e.name, e.gpu ? "gpu" : "cpu", e.start * 1e-3, e.duration * 1e-3, e.gpu ? 2 : 1);
+	}
+	std::fprintf(file, "\n]}\n");
+	if (std::fclose(file) != 0) {
+		std::cerr << path << ": cannot write the trace" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void Profiler::free() {
+#if defined(GL_VERSION_3_3) || defined(GL_ARB_timer_query)
+	for (int k = 0; k < 2; ++k) {
+		if (!sets[k].ids.empty()) {
+			glDeleteQueries((GLsizei) sets[k].ids.size(), sets[k].ids.data());
+		}
+		sets[k].ids.clear();
+		sets[k].names.clear();
+		sets[k].starts.clear();
+		sets[k].used = 0;
+	}
+#endif
+}
+
+int64_t Profiler::now() const {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - origin).count();
+}
+
+void Profiler::record(const char *name, int64_t start, int64_t duration, bool gpu) {
+	if (events.size() < max_events) {
+		Event e = { name, start, duration, gpu };
+		events.push_back(e);
+	}
+}
+
+void Profiler::collect(QuerySet &set) {
+#if defined(GL_VERSION_3_3) || defined(GL_ARB_timer_query)
+	int64_t total = 0;
+	bool complete = set.used > 0;
+	for (int i = 0; i < set.used; ++i) {
+		GLint available = 0;
+		glGetQueryObjectiv(set.ids[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			complete = false;
+			continue;
+		}
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(set.ids[i], GL_QUERY_RESULT, &elapsed);
+		record(set.names[i], set.starts[i], (int64_t) elapsed, true);
+		total += (int64_t) elapsed;
+	}
+	if (complete) {
+		push(gpu_times, total);
+	}
+#endif
+	set.used = 0;
+}
+
+void Profiler::push(std::vector<int64_t> &times, int64_t t) {
+	if ((int) times.size() == window) {
+		times.erase(times.begin());
+	}
+	times.push_back(t);
+}
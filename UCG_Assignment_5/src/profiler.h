@@ -0,0 +1,122 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+
+// Frame profiler of the editor.
+//
+// CPU zones are timed with the steady clock and may nest. GPU zones are timed
+// with GL_TIME_ELAPSED queries; their results are read two frames later,
+// when the query set of that frame is reused, so reading them never waits for
+// the GPU (results that are still not available are dropped). Every zone is
+// kept as an event of a Chrome trace (chrome://tracing or Perfetto), the GPU
+// ones on their own track, starting when they were issued.
+//
+// While disabled, a ProfileZone costs a test of a flag.
+class Profiler {
+public:
+	// Frames of the rolling summary
+	static const int window = 256;
+	// Events kept for the trace, the following ones are only summarized
+	static const size_t max_events = 1 << 20;
+
+	Profiler();
+
+	bool enabled() const { return on; }
+
+	// Start recording (the previous events are cleared) or stop
+	void set_enabled(bool enable);
+
+	// A frame covers everything between these two calls
+	void begin_frame();
+	void end_frame();
+
+	// Frames recorded since the profiler was enabled
+	int64_t frames() const { return frame; }
+
+	void begin(const char *name);
+	void end();
+
+	// GPU zones of a frame must not nest, an OpenGL context has to be current
+	void begin_gpu(const char *name);
+	void end_gpu();
+
+	// Percentiles of the frame times of the last frames, in milliseconds
+	struct Summary {
+		int frames;
+		double cpu[3];
+		// Sum of the GPU zones of a frame (-1 without timer queries)
+		double gpu[3];
+	};
+	static const double percentiles[3];
+	Summary summary() const;
+
+	// Write the events recorded since the profiler was enabled
+	bool write_trace(const std::string &path) const;
+
+	// Release the queries, while the context still exists
+	void free();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Event {
+		const char *name;
+		int64_t start;
+		int64_t duration;
+		bool gpu;
+	};
+
+	// Queries issued during one frame
+	struct QuerySet {
+		std::vector<unsigned int> ids;
+		std::vector<const char *> names;
+		std::vector<int64_t> starts;
+		int used;
+	};
+
+	bool on;
+	bool timer_queries;
+	bool gpu_open;
+	Clock::time_point origin;
+	std::vector<Event> events;
+	std::vector<std::pair<const char *, int64_t> > open;
+
+	QuerySet sets[2];
+	int64_t frame;
+	int64_t frame_start;
+
+	// Rolling frame times in nanoseconds
+	std::vector<int64_t> cpu_times;
+	std::vector<int64_t> gpu_times;
+
+	int64_t now() const;
+	void record(const char *name, int64_t start, int64_t duration, bool gpu);
+	void collect(QuerySet &set);
+	void push(std::vector<int64_t> &times, int64_t t);
+};
+
+// Times the enclosing scope
+class ProfileZone {
+public:
+	ProfileZone(Profiler &p, const char *name) : profiler(p.enabled() ? &p : 0) {
+		if (profiler) {
+			profiler->begin(name);
+		}
+	}
+	~ProfileZone() {
+		if (profiler) {
+			profiler->end();
+		}
+	}
+
+private:
+	Profiler *profiler;
+
+	ProfileZone(const ProfileZone &);
+	ProfileZone &operator=(const ProfileZone &);
+};
@@ -0,0 +1,321 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "rasterizer.h"
+#include <algorithm>
+#include <cmath>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Pack a color whose components are already scaled to [0, 255]
+inline unsigned int pack(float r, float g, float b, float a) {
+	return (unsigned int) std::lrint(r) | (unsigned int) std::lrint(g) << 8 |
+		(unsigned int) std::lrint(b) << 16 | (unsigned int) std::lrint(a) << 24;
+}
+
+inline float clamp_channel(float v) {
+	return std::min(std::max(v, 0.0f), 255.0f);
+}
+
+// Cover the pixels [x0, x1) of a row whose center is at height y. edge and
+// color hold the three planes of the edge functions and of the color channels
+// (the latter scaled to [0, 255]).
+typedef void (*SpanKernel)(const float *edge, const float *color, float y, int x0, int x1, unsigned int *row);
+
+// Same association as the vector kernels, which compute the y terms once per row
+inline float plane(const float *p, float x, float y) {
+	return p[0] * x + (p[1] * y + p[2]);
+}
+
+void span_scalar(const float *edge, const float *color, float y, int x0, int x1, unsigned int *row) {
+	for (int x = x0; x < x1; ++x) {
+		float px = (float) x + 0.5f;
+		if (plane(edge, px, y) >= 0 && plane(edge + 3, px, y) >= 0 && plane(edge + 6, px, y) >= 0) {
+			row[x] = pack(clamp_channel(plane(color, px, y)), clamp_channel(plane(color + 3, px, y)),
+				clamp_channel(plane(color + 6, px, y)), 255.0f);
+		}
+	}
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse2")
+void span_sse2(const float *edge, const float *color, float y, int x0, int x1, unsigned int *row) {
+	const __m128 zero = _mm_setzero_ps(), full = _mm_set1_ps(255.0f);
+	const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128i alpha = _mm_set1_epi32((int) 0xff000000u);
+	__m128 a[6], c[6];
+	for (int k = 0; k < 3; ++k) {
+		a[k] = _mm_set1_ps(edge[k * 3]);
+		c[k] = _mm_set1_ps(edge[k * 3 + 1] * y + edge[k * 3 + 2]);
+		a[3 + k] = _mm_set1_ps(color[k * 3]);
+		c[3 + k] = _mm_set1_ps(color[k * 3 + 1] * y + color[k * 3 + 2]);
+	}
+	int x = x0;
+	for (; x + 4 <= x1; x += 4) {
+		__m128 px = _mm_add_ps(_mm_set1_ps((float) x), lanes);
+		__m128 e0 = _mm_add_ps(_mm_mul_ps(a[0], px), c[0]);
+		__m128 e1 = _mm_add_ps(_mm_mul_ps(a[1], px), c[1]);
+		__m128 e2 = _mm_add_ps(_mm_mul_ps(a[2], px), c[2]);
+		__m128 inside = _mm_cmpge_ps(_mm_min_ps(e0, _mm_min_ps(e1, e2)), zero);
+		int mask = _mm_movemask_ps(inside);
+		if (!mask) {
+			continue;
+		}
+		__m128i rgb[3];
+		for (int k = 0; k < 3; ++k) {
+			__m128 v = _mm_add_ps(_mm_mul_ps(a[3 + k], px), c[3 + k]);
+			rgb[k] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, zero), full));
+		}
+		__m128i value = _mm_or_si128(_mm_or_si128(rgb[0], _mm_slli_epi32(rgb[1], 8)),
+			_mm_or_si128(_mm_slli_epi32(rgb[2], 16), alpha));
+		__m128i m = _mm_castps_si128(inside);
+		__m128i *p = (__m128i *) (row + x);
+		__m128i old = _mm_loadu_si128(p);
+		_mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(m, value), _mm_andnot_si128(m, old)));
+	}
+	span_scalar(edge, color, y, x, x1, row);
+}
+
+SIMD_TARGET("avx2")
+void span_avx2(const float *edge, const float *color, float y, int x0, int x1, unsigned int *row) {
+	const __m256 zero = _mm256_setzero_ps(), full = _mm256_set1_ps(255.0f);
+	const __m256 lanes = _mm256_set_ps(7.5f, 6.5f, 5.5f, 4.5f, 3.5f, 2.5f, 1.5f, 0.5f);
+	const __m256i alpha = _mm256_set1_epi32((int) 0xff000000u);
+	__m256 a[6], c[6];
+	for (int k = 0; k < 3; ++k) {
+		a[k] = _mm256_set1_ps(edge[k * 3]);
+		c[k] = _mm256_set1_ps(edge[k * 3 + 1] * y + edge[k * 3 + 2]);
+		a[3 + k] = _mm256_set1_ps(color[k * 3]);
+		c[3 + k] = _mm256_set1_ps(color[k * 3 + 1] * y + color[k * 3 + 2]);
+	}
+	int x = x0;
+	for (; x + 8 <= x1; x += 8) {
+		__m256 px = _mm256_add_ps(_mm256_set1_ps((float) x), lanes);
+		__m256 e0 = _mm256_add_ps(_mm256_mul_ps(a[0], px), c[0]);
+		__m256 e1 = _mm256_add_ps(_mm256_mul_ps(a[1], px), c[1]);
+		__m256 e2 = _mm256_add_ps(_mm256_mul_ps(a[2], px), c[2]);
+		__m256 inside = _mm256_cmp_ps(_mm256_min_ps(e0, _mm256_min_ps(e1, e2)), zero, _CMP_GE_OQ);
+		int mask = _mm256_movemask_ps(inside);
+		if (!mask) {
+			continue;
+		}
+		__m256i rgb[3];
+		for (int k = 0; k < 3; ++k) {
+			__m256 v = _mm256_add_ps(_mm256_mul_ps(a[3 + k], px), c[3 + k]);
+			rgb[k] = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, zero), full));
+		}
+		__m256i value = _mm256_or_si256(_mm256_or_si256(rgb[0], _mm256_slli_epi32(rgb[1], 8)),
+			_mm256_or_si256(_mm256_slli_epi32(rgb[2], 16), alpha));
+		__m256i *p = (__m256i *) (row + x);
+		_mm256_storeu_si256(p, _mm256_blendv_epi8(_mm256_loadu_si256(p), value, _mm256_castps_si256(inside)));
+	}
+	span_scalar(edge, color, y, x, x1, row);
+}
+
+#endif // SIMD_X86
+
+SpanKernel span_kernel(SimdLevel k) {
+	switch (k) {
+#ifdef SIMD_X86
+		case SimdSSE2: return span_sse2;
+		case SimdAVX2: return span_avx2;
+#endif
+		default: return span_scalar;
+	}
+}
+
+// Kernel in use, detected on the first call
+SimdLevel &active_kernel() {
+	static SimdLevel k = simd_best();
+	return k;
+}
+
+SpanKernel &active_span() {
+	static SpanKernel f = span_kernel(active_kernel());
+	return f;
+}
+
+// Triangles set up by one task
+const int setup_grain = 4096;
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Framebuffer::resize(int width, int height) {
+	w = width;
+	h = height;
+	pixels.resize((size_t) w * h);
+}
+
+void Framebuffer::clear(float r, float g, float b, float a) {
+	unsigned int value = pack(clamp_channel(r * 255), clamp_channel(g * 255), clamp_channel(b * 255),
+		clamp_channel(a * 255));
+	std::fill(pixels.begin(), pixels.end(), value);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void Rasterizer::run(int n, int grain, const std::function<void(int, int)> &f) {
+	if (pool) {
+		pool->parallel_for(n, grain, f);
+	} else {
+		f(0, n);
+	}
+}
+
+void Rasterizer::set_up(const TriangleStore &store, int t, const Eigen::Matrix<float, 2, 3> *vertices,
+	const Eigen::Matrix3f &view, int width, int height, Setup &s) const
+{
+	// Vertex stage: normalized device coordinates, then pixels from the top left
+	float x[3], y[3], rgb[3][3];
+	float state = store.states(0, t * 3);
+	for (int v = 0; v < 3; ++v) {
+		Eigen::Vector3f p = view * (vertices ? Eigen::Vector3f((*vertices)(0, v), (*vertices)(1, v), 1.0f)
+			: Eigen::Vector3f(store.positions.col(t * 3 + v)));
+		x[v] = (p[0] + 1) * 0.5f * width;
+		y[v] = (1 - p[1]) * 0.5f * height;
+		for (int c = 0; c < 3; ++c) {
+			float color = store.colors(c, t * 3 + v);
+			if (state == TriangleStore::Selected) {
+				color = c == 2 ? 1.0f : 0.0f;
+			} else if (state == TriangleStore::Preview) {
+				color = (color + 1) * 0.5f;
+			}
+			rgb[v][c] = color * 255;
+		}
+	}
+
+	// Edge k goes from vertex k + 1 to vertex k + 2 and vanishes on the vertex
+	// opposite to it, which makes it the barycentric weight of vertex k
+	float area = 0;
+	for (int k = 0; k < 3; ++k) {
+		int i = (k + 1) % 3, j = (k + 2) % 3;
+		s.edge[k][0] = y[i] - y[j];
+		s.edge[k][1] = x[j] - x[i];
+		s.edge[k][2] = -(s.edge[k][0] * x[i] + s.edge[k][1] * y[i]);
+		area += s.edge[k][0] * x[k] + s.edge[k][1] * y[k] + s.edge[k][2];
+	}
+	area /= 3;
+
+	float xmin = std::min(x[0], std::min(x[1], x[2])), xmax = std::max(x[0], std::max(x[1], x[2]));
+	float ymin = std::min(y[0], std::min(y[1], y[2])), ymax = std::max(y[0], std::max(y[1], y[2]));
+	s.x0 = std::max(0, (int) std::floor(std::max(xmin, -1.0f)));
+	s.y0 = std::max(0, (int) std::floor(std::max(ymin, -1.0f)));
+	s.x1 = std::min(width, (int) std::ceil(std::min(xmax, (float) width + 1)));
+	s.y1 = std::min(height, (int) std::ceil(std::min(ymax, (float) height + 1)));
+	if (area == 0 || !(s.x0 < s.x1 && s.y0 < s.y1)) {
+		// Degenerate or off screen, nothing to draw
+		s.x1 = s.x0;
+		return;
+	}
+
+	// Orient the edges so that they are positive inside, and normalize them
+	// for the color planes
+	float sign = area > 0 ? 1.0f : -1.0f;
+	for (int k = 0; k < 3; ++k) {
+		for (int i = 0; i < 3; ++i) {
+			s.edge[k][i] *= sign;
+		}
+	}
+	for (int c = 0; c < 3; ++c) {
+		for (int i = 0; i < 3; ++i) {
+			s.color[c][i] = (rgb[0][c] * s.edge[0][i] + rgb[1][c] * s.edge[1][i] + rgb[2][c] * s.edge[2][i]) /
+				(area * sign);
+		}
+	}
+}
+
+void Rasterizer::draw(const TriangleStore &store, int begin, int end, const Eigen::Matrix3f &view,
+	Framebuffer &target)
+{
+	draw(store, begin, end, view, target, 0, 0);
+}
+
+void Rasterizer::draw(const TriangleStore &store, int begin, int end, const Eigen::Matrix3f &view,
+	Framebuffer &target, const int *posed, const Eigen::Matrix<float, 2, 3> *moved)
+{
+	const int n = end - begin;
+	const int width = target.width(), height = target.height();
+	if (n <= 0 || width <= 0 || height <= 0) {
+		return;
+	}
+	const int tiles_x = (width + tile_size - 1) / tile_size;
+	const int tiles_y = (height + tile_size - 1) / tile_size;
+	const int tiles = tiles_x * tiles_y;
+
+	setups.resize(n);
+	run(n, setup_grain, [&](int first, int last) {
+		for (int i = first; i < last; ++i) {
+			int t = begin + i;
+			set_up(store, t, posed && posed[t] != -1 ? &moved[posed[t]] : 0, view, width, height, setups[i]);
+		}
+	});
+
+	// Bin every slice of the triangles on its own, the lists of a tile are
+	// then walked slice after slice, which keeps the triangle order
+	const int slices = pool ? std::min(pool->size() * 4, std::max(1, n / setup_grain)) : 1;
+	bins.resize(slices);
+	run(slices, 1, [&](int first, int last) {
+		for (int j = first; j < last; ++j) {
+			std::vector<std::vector<int> > &lists = bins[j];
+			lists.resize(tiles);
+			for (int k = 0; k < tiles; ++k) {
+				lists[k].clear();
+			}
+			int from = (int) ((long long) n * j / slices), to = (int) ((long long) n * (j + 1) / slices);
+			for (int i = from; i < to; ++i) {
+				const Setup &s = setups[i];
+				if (s.x0 == s.x1) {
+					continue;
+				}
+				for (int ty = s.y0 / tile_size; ty <= (s.y1 - 1) / tile_size; ++ty) {
+					for (int tx = s.x0 / tile_size; tx <= (s.x1 - 1) / tile_size; ++tx) {
+						lists[ty * tiles_x + tx].push_back(i);
+					}
+				}
+			}
+		}
+	});
+
+	run(tiles, 1, [&](int first, int last) {
+		for (int k = first; k < last; ++k) {
+			draw_tile(k % tiles_x, k / tiles_x, slices, target);
+		}
+	});
+}
+
+void Rasterizer::draw_tile(int tx, int ty, int slices, Framebuffer &target) const {
+	const int tiles_x = (target.width() + tile_size - 1) / tile_size;
+	const int left = tx * tile_size, top = ty * tile_size;
+	const int right = std::min(left + tile_size, target.width());
+	const int bottom = std::min(top + tile_size, target.height());
+	SpanKernel span = active_span();
+
+	for (int j = 0; j < slices; ++j) {
+		const std::vector<int> &list = bins[j][ty * tiles_x + tx];
+		for (size_t i = 0; i < list.size(); ++i) {
+			const Setup &s = setups[list[i]];
+			int x0 = std::max(s.x0, left), x1 = std::min(s.x1, right);
+			int y1 = std::min(s.y1, bottom);
+			for (int y = std::max(s.y0, top); y < y1; ++y) {
+				span(&s.edge[0][0], &s.color[0][0], y + 0.5f, x0, x1, target.row(y));
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+SimdLevel raster_kernel() {
+	return active_kernel();
+}
+
+bool set_raster_kernel(SimdLevel k) {
+	if (!simd_supported(k)) {
+		return false;
+	}
+	active_kernel() = k;
+	active_span() = span_kernel(k);
+	return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "thread_pool.h"
+#include "simd.h"
+#include <Eigen/Core>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// In-memory RGBA image, 8 bits per channel, rows from the top of the image
+class Framebuffer {
+public:
+	Framebuffer() : w(0), h(0) { }
+	Framebuffer(int width, int height) { resize(width, height); }
+
+	int width() const { return w; }
+	int height() const { return h; }
+
+	void resize(int width, int height);
+
+	// Fill every pixel with the given color (components in [0, 1])
+	void clear(float r, float g, float b, float a = 1.0f);
+
+	// Pixel (x, y) packed as R | G << 8 | B << 16 | A << 24, so that the bytes of
+	// a row are in RGBA order on little-endian machines
+	unsigned int pixel(int x, int y) const { return pixels[(size_t) y * w + x]; }
+	unsigned int *row(int y) { return &pixels[(size_t) y * w]; }
+	const unsigned int *row(int y) const { return &pixels[(size_t) y * w]; }
+
+	// width() * height() * 4 bytes
+	const unsigned char *data() const { return (const unsigned char *) pixels.data(); }
+
+private:
+	int w;
+	int h;
+	std::vector<unsigned int> pixels;
+};
+
+// Software implementation of the editor's triangle pipeline.
+//
+// Vertices go through the same transform as the vertex shader (view * position,
+// the store positions already include the per-triangle motion) and the same
+// state colors, then every triangle is drawn with its vertex colors
+// interpolated, in index order, without blending, like glDrawArrays.
+//
+// The triangles are set up and binned into square screen tiles in parallel,
+// then the tiles are rasterized in parallel: each tile is owned by a single
+// thread and walks its bins in triangle order, so the result does not depend
+// on the number of threads. Spans of pixels are covered by a SIMD kernel that
+// evaluates the three edge functions and the color planes of several pixels
+// at once.
+class Rasterizer {
+public:
+	// Side of a screen tile, in pixels
+	static const int tile_size = 64;
+
+	explicit Rasterizer(ThreadPool *pool = 0) : pool(pool) { }
+
+	// Draw triangles [begin, end) of store into target. view maps positions
+	// to normalized device coordinates, (-1, -1) being the bottom left corner.
+	void draw(const TriangleStore &store, int begin, int end, const Eigen::Matrix3f &view, Framebuffer &target);
+
+	// Same, but triangle t is drawn with the vertices (one per column) moved[posed[t]]
+	// instead of those of the store when posed[t] != -1. posed has one entry per
+	// triangle of the store, which is only read, so several threads can draw
+	// different poses of the same scene.
+	void draw(const TriangleStore &store, int begin, int end, const Eigen::Matrix3f &view, Framebuffer &target,
+		const int *posed, const Eigen::Matrix<float, 2, 3> *moved);
+
+private:
+	// Edge functions and color planes of a triangle, in pixels
+	struct Setup {
+		// e_k(x, y) = edge[k][0] * x + edge[k][1] * y + edge[k][2], all of them
+		// are non-negative inside
+		float edge[3][3];
+		// channel(x, y) = color[c][0] * x + color[c][1] * y + color[c][2]
+		float color[3][3];
+		// Bounding box, in pixels, clamped to the target (x1, y1 excluded)
+		int x0, y0, x1, y1;
+	};
+
+	ThreadPool *pool;
+
+	// Set up triangles, one per triangle drawn (empty ones have x0 == x1)
+	std::vector<Setup> setups;
+
+	// Triangles overlapping every tile, one list of tiles per slice of the
+	// triangles so that the slices can be binned in parallel
+	std::vector<std::vector<std::vector<int> > > bins;
+
+	void run(int n, int grain, const std::function<void(int, int)> &f);
+
+	// Set up triangle t of store, with the given vertices if not null
+	void set_up(const TriangleStore &store, int t, const Eigen::Matrix<float, 2, 3> *vertices,
+		const Eigen::Matrix3f &view, int width, int height, Setup &s) const;
+
+	void draw_tile(int tx, int ty, int slices, Framebuffer &target) const;
+};
+
+// Kernel used to cover spans of pixels, the best supported one by default
+SimdLevel raster_kernel();
+
+// Use kernel k from now on, returns false (and keeps the current kernel) if it
+// is not supported
+bool set_raster_kernel(SimdLevel k);
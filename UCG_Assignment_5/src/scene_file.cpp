@@ -0,0 +1,411 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "scene_file.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const char scene_magic[8] = { 'U', 'C', 'G', 'S', 'C', 'E', 'N', 'E' };
+const uint32_t scene_version = 1;
+const size_t section_alignment = 16;
+
+static_assert(sizeof(SceneHeader) == 248, "the header layout is part of the file format");
+
+// Offset of the first section of the given channel
+inline int key_section(int channel, int array) {
+	return SceneHeader::Keys + channel * 5 + array;
+}
+
+// Size in bytes of every section, given the counts of the header
+void section_sizes(const SceneHeader &h, uint64_t *sizes) {
+	uint64_t n = h.triangles, m = h.objects;
+	sizes[SceneHeader::Positions] = n * 9 * sizeof(float);
+	sizes[SceneHeader::Colors] = n * 9 * sizeof(float);
+	sizes[SceneHeader::Transforms] = n * 6 * sizeof(float);
+	sizes[SceneHeader::Objects] = m * sizeof(int32_t);
+	sizes[SceneHeader::Rests] = m * 8 * sizeof(float);
+	sizes[SceneHeader::Counts] = m * KeyframeStore::channels * sizeof(int32_t);
+	for (int c = 0; c < KeyframeStore::channels; ++c) {
+		uint64_t k = h.keys[c], w = KeyframeStore::width((KeyframeStore::Channel) c);
+		sizes[key_section(c, 0)] = k * sizeof(float);
+		sizes[key_section(c, 1)] = k * w * sizeof(float);
+		sizes[key_section(c, 2)] = k * w * sizeof(float);
+		sizes[key_section(c, 3)] = k * w * sizeof(float);
+		sizes[key_section(c, 4)] = k;
+	}
+}
+
+bool little_endian() {
+	uint32_t one = 1;
+	unsigned char first;
+	std::memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+// Sequential writer that pads the sections to their alignment
+class Writer {
+public:
+	explicit Writer(FILE *file) : file(file), offset(0), ok(true) { }
+
+	void write(const void *data, size_t bytes) {
+		ok = ok && std::fwrite(data, 1, bytes, file) == bytes;
+		offset += bytes;
+	}
+
+	// Pad to the next section and return its offset
+	uint64_t begin_section() {
+		static const char zeros[section_alignment] = { 0 };
+		size_t padding = (section_alignment - offset % section_alignment) % section_alignment;
+		write(zeros, padding);
+		return offset;
+	}
+
+	FILE *file;
+	uint64_t offset;
+	bool ok;
+};
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool save_scene_file(const std::string &path, const TriangleStore &triangles, int n,
+	const KeyframeStore &keyframes, const Eigen::Matrix3f &view)
+{
+	if (!little_endian()) {
+		std::cerr << path << ": scene files are only written on little-endian machines" << std::endl;
+		return false;
+	}
+
+	// Objects of the triangles that are saved
+	std::vector<int> objects;
+	for (int o = 0; o < keyframes.size(); ++o) {
+		if (keyframes.triangle(o) < n) {
+			objects.push_back(o);
+		}
+	}
+
+	SceneHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, scene_magic, sizeof(h.magic));
+	h.version = scene_version;
+	h.header_bytes = sizeof(SceneHeader);
+	h.triangles = n;
+	h.objects = (uint32_t) objects.size();
+	for (int c = 0; c < KeyframeStore::channels; ++c) {
+		for (size_t i = 0; i < objects.size(); ++i) {
+			h.keys[c] += keyframes.keys(objects[i], (KeyframeStore::Channel) c);
+		}
+	}
+	Eigen::Map<Eigen::Matrix3f>(h.view) = view;
+
+	FILE *file = std::fopen(path.c_str(), "wb");
+	if (!file) {
+		std::cerr << path << ": cannot write the scene" << std::endl;
+		return false;
+	}
+	Writer out(file);
+	// The offsets are only known once the sections are written
+	out.write(&h, sizeof(h));
+
+	// Vertices before the transform of their triangle, as the GPU has them
+	h.offsets[SceneHeader::Positions] = out.begin_section();
+	const int chunk = 4096;
+	std::vector<float> base;
+	for (int first = 0; first < n; first += chunk) {
+		int last = std::min(n, first + chunk);
+		base.assign(triangles.position_data() + first * 9, triangles.position_data() + last * 9);
+		for (int t = first; t < last; ++t) {
+			if (!triangles.transformed(t)) {
+				continue;
+			}
+			TriangleStore::Affine m = triangles.transform(t);
+			float det = m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0);
+			if (det == 0) {
+				continue;
+			}
+			Eigen::Matrix2f inverse;
+			inverse << m(1, 1), -m(0, 1), -m(1, 0), m(0, 0);
+			inverse /= det;
+			for (int v = 0; v < 3; ++v) {
+				Eigen::Map<Eigen::Vector2f> p(&base[(t - first) * 9 + v * 3]);
+				p = inverse * (p - m.col(2));
+			}
+		}
+		out.write(base.data(), base.size() * sizeof(float));
+	}
+	h.offsets[SceneHeader::Colors] = out.begin_section();
+	out.write(triangles.color_data(), (size_t) n * 9 * sizeof(float));
+
+	// A singular transform cannot be undone, those triangles are saved with
+	// their current vertices and no transform
+	h.offsets[SceneHeader::Transforms] = out.begin_section();
+	for (int first = 0; first < n; first += chunk) {
+		int last = std::min(n, first + chunk);
+		base.assign(triangles.transform_data() + first * 6, triangles.transform_data() + last * 6);
+		for (int t = first; t < last; ++t) {
+			TriangleStore::Affine m = triangles.transform(t);
+			if (m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0) == 0) {
+				Eigen::Map<TriangleStore::Affine> saved(&base[(t - first) * 6]);
+				saved = TriangleStore::Affine::Identity();
+			}
+		}
+		out.write(base.data(), base.size() * sizeof(float));
+	}
+
+	h.offsets[SceneHeader::Objects] = out.begin_section();
+	for (size_t i = 0; i < objects.size(); ++i) {
+		int32_t t = keyframes.triangle(objects[i]);
+		out.write(&t, sizeof(t));
+	}
+	h.offsets[SceneHeader::Rests] = out.begin_section();
+	for (size_t i = 0; i < objects.size(); ++i) {
+		out.write(keyframes.rest_pose(objects[i]), 8 * sizeof(float));
+	}
+	h.offsets[SceneHeader::Counts] = out.begin_section();
+	for (size_t i = 0; i < objects.size(); ++i) {
+		for (int c = 0; c < KeyframeStore::channels; ++c) {
+			int32_t count = keyframes.keys(objects[i], (KeyframeStore::Channel) c);
+			out.write(&count, sizeof(count));
+		}
+	}
+
+	for (int c = 0; c < KeyframeStore::channels; ++c) {
+		KeyframeStore::Channel channel = (KeyframeStore::Channel) c;
+		size_t w = KeyframeStore::width(channel);
+		for (int array = 0; array < 5; ++array) {
+			h.offsets[key_section(c, array)] = out.begin_section();
+			for (size_t i = 0; i < objects.size(); ++i) {
+				int o = objects[i];
+				for (int k = 0; k < keyframes.keys(o, channel); ++k) {
+					switch (array) {
+						case 0: {
+							float time = keyframes.key_time(o, channel, k);
+							out.write(&time, sizeof(time));
+							break;
+						}
+						case 1: out.write(keyframes.key_value(o, channel, k), w * sizeof(float)); break;
+						case 2: out.write(keyframes.key_tangent_in(o, channel, k), w * sizeof(float)); break;
+						case 3: out.write(keyframes.key_tangent_out(o, channel, k), w * sizeof(float)); break;
+						default: {
+							unsigned char mode = (unsigned char) keyframes.key_interpolation(o, channel, k);
+							out.write(&mode, 1);
+						}
+					}
+				}
+			}
+		}
+	}
+	h.file_bytes = out.offset;
+
+	// Now that the offsets are known, write the header again
+	out.ok = out.ok && std::fseek(file, 0, SEEK_SET) == 0;
+	out.write(&h, sizeof(h));
+	out.ok = std::fclose(file) == 0 && out.ok;
+	if (!out.ok) {
+		std::cerr << path << ": cannot write the scene" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool SceneFile::open(const std::string &path) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	LARGE_INTEGER file_size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) {
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+		std::cerr << path << ": cannot open the scene" << std::endl;
+		return false;
+	}
+	handle = file;
+	size = (size_t) file_size.QuadPart;
+	if (size >= sizeof(SceneHeader)) {
+		mapping_handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_handle) {
+			bytes = (const unsigned char *) MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+		}
+	}
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) != 0) {
+		if (fd != -1) {
+			::close(fd);
+		}
+		std::cerr << path << ": cannot open the scene" << std::endl;
+		return false;
+	}
+	size = (size_t) st.st_size;
+	if (size >= sizeof(SceneHeader)) {
+		void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			bytes = (const unsigned char *) p;
+			// The streams are read front to back by the upload
+			madvise(p, size, MADV_SEQUENTIAL);
+		}
+	}
+	// The mapping keeps the file alive
+	::close(fd);
+#endif
+
+	if (!bytes) {
+		std::cerr << path << ": not a scene file" << std::endl;
+		close();
+		return false;
+	}
+
+	// Check the header, then that every section lies inside the file
+	const SceneHeader &h = header();
+	const char *problem = NULL;
+	if (std::memcmp(h.magic, scene_magic, sizeof(scene_magic)) != 0) {
+		problem = "not a scene file";
+	} else if (h.version > scene_version) {
+		problem = "scene written by a newer version";
+	} else if (h.header_bytes != sizeof(SceneHeader) || h.file_bytes != size) {
+		problem = "damaged or truncated scene";
+	} else if (!little_endian()) {
+		problem = "scene files are only read on little-endian machines";
+	}
+	uint64_t sizes[SceneHeader::Sections];
+	section_sizes(h, sizes);
+	for (int s = 0; s < SceneHeader::Sections && !problem; ++s) {
+		if (h.offsets[s] % section_alignment != 0 || h.offsets[s] > size || sizes[s] > size - h.offsets[s]) {
+			problem = "damaged or truncated scene";
+		}
+	}
+	if (!problem && h.triangles > (uint32_t) 0x7fffffff / 9) {
+		problem = "too many triangles";
+	}
+
+	// The tracks must add up to the keys of every channel and refer to triangles
+	const int32_t *objects = section<int32_t>(SceneHeader::Objects);
+	const int32_t *counts = section<int32_t>(SceneHeader::Counts);
+	uint64_t keys[KeyframeStore::channels] = { 0, 0, 0 };
+	for (uint32_t o = 0; o < h.objects && !problem; ++o) {
+		if (objects[o] < 0 || (uint32_t) objects[o] >= h.triangles) {
+			problem = "animated triangle out of range";
+		}
+		for (int c = 0; c < KeyframeStore::channels; ++c) {
+			if (counts[o * KeyframeStore::channels + c] < 0) {
+				problem = "damaged or truncated scene";
+			}
+			keys[c] += (uint32_t) counts[o * KeyframeStore::channels + c];
+		}
+	}
+	for (int c = 0; c < KeyframeStore::channels && !problem; ++c) {
+		const unsigned char *modes = section<unsigned char>(key_section(c, 4));
+		if (keys[c] != h.keys[c]) {
+			problem = "damaged or truncated scene";
+		}
+		for (uint32_t k = 0; k < h.keys[c] && !problem; ++k) {
+			if (modes[k] > KeyframeStore::Bezier) {
+				problem = "damaged or truncated scene";
+			}
+		}
+	}
+
+	if (problem) {
+		std::cerr << path << ": " << problem << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void SceneFile::close() {
+#ifdef _WIN32
+	if (bytes) {
+		UnmapViewOfFile(bytes);
+	}
+	if (mapping_handle) {
+		CloseHandle(mapping_handle);
+	}
+	if (handle) {
+		CloseHandle(handle);
+	}
+#else
+	if (bytes) {
+		munmap((void *) bytes, size);
+	}
+#endif
+	bytes = NULL;
+	size = 0;
+	handle = NULL;
+	mapping_handle = NULL;
+}
+
+void SceneFile::load_triangles(TriangleStore &store) const {
+	int n = triangles();
+	store.resize(n);
+	std::memcpy(store.positions.data(), positions(), (size_t) n * 9 * sizeof(float));
+	std::memcpy(store.colors.data(), colors(), (size_t) n * 9 * sizeof(float));
+	std::memcpy(store.transforms.data(), transforms(), (size_t) n * 6 * sizeof(float));
+	store.states.leftCols(n * 3).setConstant((float) TriangleStore::Normal);
+
+	// The editor keeps the vertices after the transform
+	for (int t = 0; t < n; ++t) {
+		if (store.transformed(t)) {
+			TriangleStore::Affine m = store.transform(t);
+			for (int v = 0; v < 3; ++v) {
+				store.positions.col(t * 3 + v).head<2>() = m.leftCols<2>() * store.positions.col(t * 3 + v).head<2>() +
+					m.col(2);
+			}
+		}
+	}
+}
+
+void SceneFile::load_keyframes(KeyframeStore &keyframes) const {
+	keyframes.clear();
+	const SceneHeader &h = header();
+	const int32_t *objects = section<int32_t>(SceneHeader::Objects);
+	const float *rests = section<float>(SceneHeader::Rests);
+	const int32_t *counts = section<int32_t>(SceneHeader::Counts);
+
+	// Objects are added in order, so every key goes at the end of its channel
+	int first[KeyframeStore::channels] = { 0, 0, 0 };
+	for (uint32_t i = 0; i < h.objects; ++i) {
+		int o = keyframes.add(objects[i], rests + i * 8);
+		for (int c = 0; c < KeyframeStore::channels; ++c) {
+			KeyframeStore::Channel channel = (KeyframeStore::Channel) c;
+			int w = KeyframeStore::width(channel);
+			const float *times = section<float>(key_section(c, 0));
+			const float *values = section<float>(key_section(c, 1));
+			const float *tangents_in = section<float>(key_section(c, 2));
+			const float *tangents_out = section<float>(key_section(c, 3));
+			const unsigned char *modes = section<unsigned char>(key_section(c, 4));
+			int count = counts[i * KeyframeStore::channels + c];
+			for (int j = first[c]; j < first[c] + count; ++j) {
+				int k = keyframes.set_key(o, channel, times[j], values + j * w);
+				if (modes[j] == KeyframeStore::Bezier) {
+					keyframes.set_tangents(o, channel, k, tangents_in + j * w, tangents_out + j * w);
+				} else {
+					keyframes.set_interpolation(o, channel, k, (KeyframeStore::Interpolation) modes[j]);
+				}
+			}
+			first[c] += count;
+		}
+	}
+}
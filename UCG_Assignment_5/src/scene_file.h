@@ -0,0 +1,106 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "keyframes.h"
+#include <Eigen/Core>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+// Binary scenes, laid out to be memory-mapped.
+//
+// A fixed-size header is followed by sections, each starting on a 16-byte
+// boundary at the offset recorded in the header:
+//
+//   Positions    (x, y, 1) of every vertex, the stream of the position VBO
+//   Colors       (r, g, b) of every vertex, the stream of the color VBO
+//   Transforms   2x3 affine of every triangle, the stream of the transform
+//                buffer. Positions hold the vertices before it, like the
+//                GPU copy of the positions, so the three streams can be
+//                uploaded as they are.
+//   Objects      triangle index (int32) of every animated object
+//   Rests        rest pose of every object (8 floats, see KeyframeStore)
+//   Counts       number of keys of every track (int32, object after object)
+//   then, for every channel, the times, values, incoming and outgoing
+//   tangents (floats) and interpolations (bytes) of its keys, track after track.
+//
+// Files are little-endian. The version changes whenever the layout does,
+// older readers refuse newer files.
+
+struct SceneHeader {
+	enum Section {
+		Positions,
+		Colors,
+		Transforms,
+		Objects,
+		Rests,
+		Counts,
+		// Times, values, tangents in, tangents out and modes of each channel
+		Keys,
+		Sections = Keys + 5 * KeyframeStore::channels
+	};
+
+	char magic[8];
+	uint32_t version;
+	uint32_t header_bytes;
+	uint32_t triangles;
+	uint32_t objects;
+	// Number of keys of every channel
+	uint32_t keys[KeyframeStore::channels];
+	// Column-major view matrix
+	float view[9];
+	uint64_t offsets[Sections];
+	// Size of the whole file, a shorter file was truncated
+	uint64_t file_bytes;
+};
+
+// Write the first n triangles of triangles with their key frames and the view
+bool save_scene_file(const std::string &path, const TriangleStore &triangles, int n,
+	const KeyframeStore &keyframes, const Eigen::Matrix3f &view);
+
+// Read-only mapping of a scene file. The stream pointers stay valid until
+// close() and are 16-byte aligned.
+class SceneFile {
+public:
+	SceneFile() : bytes(NULL), size(0), handle(NULL), mapping_handle(NULL) { }
+	~SceneFile() { close(); }
+
+	// Map the file and check its header and sections, reports the problem on
+	// std::cerr and returns false if it cannot be used
+	bool open(const std::string &path);
+	void close();
+
+	int triangles() const { return (int) header().triangles; }
+	Eigen::Matrix3f view() const { return Eigen::Map<const Eigen::Matrix3f>(header().view); }
+
+	// Streams in the layout of the GPU buffers (3 * triangles() columns of 3
+	// floats for positions and colors, triangles() columns of 6 floats for
+	// transforms)
+	const float *positions() const { return section<float>(SceneHeader::Positions); }
+	const float *colors() const { return section<float>(SceneHeader::Colors); }
+	const float *transforms() const { return section<float>(SceneHeader::Transforms); }
+
+	// Copy the triangles into store with the transforms applied to their
+	// positions, like the editor keeps them
+	void load_triangles(TriangleStore &store) const;
+
+	// Replace the content of keyframes with the tracks of the file
+	void load_keyframes(KeyframeStore &keyframes) const;
+
+private:
+	const unsigned char *bytes;
+	size_t size;
+	// Platform handles of the file and of its mapping
+	void *handle;
+	void *mapping_handle;
+
+	const SceneHeader &header() const { return *(const SceneHeader *) bytes; }
+
+	template <typename T>
+	const T *section(int s) const { return (const T *) (bytes + header().offsets[s]); }
+
+	SceneFile(const SceneFile &);
+	SceneFile &operator=(const SceneFile &);
+};
@@ -0,0 +1,191 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "scene_io.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const char *channel_names[KeyframeStore::channels] = { "position", "rotation", "scale" };
+const char *interpolation_names[] = { "linear", "catmull-rom", "bezier" };
+
+// Index of name in names, -1 if absent
+int lookup(const std::string &name, const char *const *names, int n) {
+	for (int i = 0; i < n; ++i) {
+		if (name == names[i]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Read n floats, false if the line is too short
+bool read_floats(std::istream &in, float *out, int n) {
+	for (int i = 0; i < n; ++i) {
+		if (!(in >> out[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool parse_key(std::istringstream &in, TriangleStore &triangles, KeyframeStore &keyframes) {
+	int t;
+	std::string channel, mode;
+	float time, value[2], tangent_in[2], tangent_out[2];
+	if (!(in >> t >> channel >> time)) {
+		return false;
+	}
+	int c = lookup(channel, channel_names, KeyframeStore::channels);
+	if (c == -1 || t < 0 || t >= triangles.size()) {
+		return false;
+	}
+	int w = KeyframeStore::width((KeyframeStore::Channel) c);
+	if (!read_floats(in, value, w)) {
+		return false;
+	}
+	int interpolation = KeyframeStore::Linear;
+	if (in >> mode) {
+		interpolation = lookup(mode, interpolation_names, 3);
+		if (interpolation == -1) {
+			return false;
+		}
+		if (interpolation == KeyframeStore::Bezier && !(read_floats(in, tangent_in, w) && read_floats(in, tangent_out, w))) {
+			return false;
+		}
+	}
+
+	int o = keyframes.add(triangles, t);
+	int k = keyframes.set_key(o, (KeyframeStore::Channel) c, time, value);
+	if (interpolation == KeyframeStore::Bezier) {
+		keyframes.set_tangents(o, (KeyframeStore::Channel) c, k, tangent_in, tangent_out);
+	} else {
+		keyframes.set_interpolation(o, (KeyframeStore::Channel) c, k, (KeyframeStore::Interpolation) interpolation);
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool load_scene(const std::string &path, TriangleStore &triangles, KeyframeStore &keyframes,
+	Eigen::Matrix3f &view)
+{
+	std::ifstream file(path.c_str());
+	if (!file) {
+		std::cerr << path << ": cannot open the scene" << std::endl;
+		return false;
+	}
+	triangles.clear();
+	keyframes.clear();
+	view.setIdentity();
+
+	std::string line;
+	for (int number = 1; std::getline(file, line); ++number) {
+		size_t comment = line.find('#');
+		if (comment != std::string::npos) {
+			line.erase(comment);
+		}
+		std::istringstream in(line);
+		std::string statement;
+		if (!(in >> statement)) {
+			continue;
+		}
+
+		bool ok = false;
+		if (statement == "triangle") {
+			float v[15];
+			if ((ok = read_floats(in, v, 15))) {
+				int t = triangles.append(Eigen::Vector2f(v[0], v[1]), Eigen::Vector2f(v[5], v[6]),
+					Eigen::Vector2f(v[10], v[11]), Eigen::Vector3f(v[2], v[3], v[4]));
+				triangles.colors.col(t * 3 + 1) << v[7], v[8], v[9];
+				triangles.colors.col(t * 3 + 2) << v[12], v[13], v[14];
+			}
+		} else if (statement == "view") {
+			float m[9];
+			if ((ok = read_floats(in, m, 9))) {
+				view = Eigen::Map<Eigen::Matrix<float, 3, 3, Eigen::RowMajor> >(m);
+			}
+		} else if (statement == "key") {
+			ok = parse_key(in, triangles, keyframes);
+		}
+		if (!ok) {
+			std::cerr << path << ":" << number << ": invalid statement \"" << line << "\"" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool save_scene(const std::string &path, const TriangleStore &triangles, int n, const KeyframeStore &keyframes,
+	const Eigen::Matrix3f &view)
+{
+	std::ofstream file(path.c_str());
+	if (!file) {
+		std::cerr << path << ": cannot write the scene" << std::endl;
+		return false;
+	}
+	file.precision(9);
+
+	file << "view";
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			file << " " << view(i, j);
+		}
+	}
+	file << "\n";
+
+	// Animated triangles are written in their rest pose, the one their keys
+	// are relative to
+	const KeyframeStore::Affine identity = KeyframeStore::Affine::Identity();
+	for (int t = 0; t < n; ++t) {
+		int o = keyframes.find(t);
+		file << "triangle";
+		for (int v = 0; v < 3; ++v) {
+			Eigen::Vector2f p = o == -1 ? Eigen::Vector2f(triangles.positions.col(t * 3 + v).head<2>())
+				: Eigen::Vector2f(keyframes.vertices(o, identity).col(v));
+			file << "  " << p[0] << " " << p[1];
+			for (int c = 0; c < 3; ++c) {
+				file << " " << triangles.colors(c, t * 3 + v);
+			}
+		}
+		file << "\n";
+	}
+
+	for (int o = 0; o < keyframes.size(); ++o) {
+		int t = keyframes.triangle(o);
+		if (t >= n) {
+			continue;
+		}
+		for (int c = 0; c < KeyframeStore::channels; ++c) {
+			KeyframeStore::Channel channel = (KeyframeStore::Channel) c;
+			int w = KeyframeStore::width(channel);
+			for (int k = 0; k < keyframes.keys(o, channel); ++k) {
+				KeyframeStore::Interpolation mode = keyframes.key_interpolation(o, channel, k);
+				file << "key " << t << " " << channel_names[c] << " " << keyframes.key_time(o, channel, k);
+				for (int d = 0; d < w; ++d) {
+					file << " " << keyframes.key_value(o, channel, k)[d];
+				}
+				file << " " << interpolation_names[mode];
+				if (mode == KeyframeStore::Bezier) {
+					for (int d = 0; d < w; ++d) {
+						file << " " << keyframes.key_tangent_in(o, channel, k)[d];
+					}
+					for (int d = 0; d < w; ++d) {
+						file << " " << keyframes.key_tangent_out(o, channel, k)[d];
+					}
+				}
+				file << "\n";
+			}
+		}
+	}
+
+	file.flush();
+	if (!file) {
+		std::cerr << path << ": cannot write the scene" << std::endl;
+		return false;
+	}
+	return true;
+}
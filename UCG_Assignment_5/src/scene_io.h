@@ -0,0 +1,31 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "keyframes.h"
+#include <Eigen/Core>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+// Plain-text scenes: the triangles, their key frames and the view.
+//
+// One statement per line, '#' starts a comment:
+//
+//   view m00 m01 m02 m10 m11 m12 m20 m21 m22
+//   triangle x y r g b  x y r g b  x y r g b
+//   key <triangle> position|rotation|scale <time> <value...> [linear|catmull-rom]
+//   key <triangle> position|rotation|scale <time> <value...> bezier <in...> <out...>
+//
+// Triangles are numbered in file order from 0 and their vertices are their
+// rest pose. Keys may come in any order, rotations are in radians and the
+// tangents of Bezier keys in units per second.
+
+// Replace the content of triangles, keyframes and view with the scene stored
+// at path. Reports the first error on std::cerr and returns false.
+bool load_scene(const std::string &path, TriangleStore &triangles, KeyframeStore &keyframes,
+	Eigen::Matrix3f &view);
+
+// Write the first n triangles of triangles with their rest pose, the key frames
+// of the ones that are animated and the view
+bool save_scene(const std::string &path, const TriangleStore &triangles, int n, const KeyframeStore &keyframes,
+	const Eigen::Matrix3f &view);
@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "simd.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+#ifdef SIMD_X86
+
+bool cpu_has_sse2() {
+#if defined(__x86_64__) || defined(_M_X64)
+	return true;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool cpu_has_avx2() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	// The OS has to save the AVX registers (OSXSAVE + AVX, then XCR0)
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) {
+		return false;
+	}
+	if ((_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // SIMD_X86
+
+SimdLevel detect() {
+	if (simd_supported(SimdAVX2)) {
+		return SimdAVX2;
+	}
+	if (simd_supported(SimdSSE2)) {
+		return SimdSSE2;
+	}
+	return SimdScalar;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool simd_supported(SimdLevel level) {
+	switch (level) {
+		case SimdScalar: return true;
+#ifdef SIMD_X86
+		case SimdSSE2: return cpu_has_sse2();
+		case SimdAVX2: return cpu_has_avx2();
+#endif
+		default: return false;
+	}
+}
+
+SimdLevel simd_best() {
+	static SimdLevel level = detect();
+	return level;
+}
+
+const char *simd_name(SimdLevel level) {
+	switch (level) {
+		case SimdSSE2: return "sse2";
+		case SimdAVX2: return "avx2";
+		default: return "scalar";
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+// Runtime detection of the instruction sets used by the batched kernels.
+//
+// Kernels are compiled for every level and the best one supported by the CPU
+// is picked at run time, so the binary does not depend on the build flags.
+
+// GCC and Clang only emit instructions beyond the build target in functions
+// explicitly compiled for them, MSVC accepts the intrinsics anywhere
+#if defined(__GNUC__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+enum SimdLevel {
+	SimdScalar = 0,
+	SimdSSE2 = 1,
+	SimdAVX2 = 2
+};
+
+// Whether the CPU (and the OS, for the AVX registers) supports level
+bool simd_supported(SimdLevel level);
+
+// Highest supported level, detected once
+SimdLevel simd_best();
+
+const char *simd_name(SimdLevel level);
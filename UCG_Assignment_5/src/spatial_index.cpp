@@ -0,0 +1,468 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "spatial_index.h"
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <limits>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+void erase_value(std::vector<int> &items, int value) {
+	std::vector<int>::iterator it = std::find(items.begin(), items.end(), value);
+	assert(it != items.end());
+	*it = items.back();
+	items.pop_back();
+}
+
+// Index of the lowest set bit of a non-zero word
+inline int lowest_bit(uint64_t bits) {
+#if defined(__GNUC__)
+	return __builtin_ctzll(bits);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long i;
+	_BitScanForward64(&i, bits);
+	return (int) i;
+#else
+	int i = 0;
+	for (; !(bits & 1); bits >>= 1) {
+		++i;
+	}
+	return i;
+#endif
+}
+
+void replace_value(std::vector<int> &items, int from, int to) {
+	std::vector<int>::iterator it = std::find(items.begin(), items.end(), from);
+	assert(it != items.end());
+	*it = to;
+}
+
+// Add delta to every id >= first
+void shift_ids(std::vector<int> &items, int first, int delta) {
+	for (size_t i = 0; i < items.size(); ++i) {
+		if (items[i] >= first) {
+			items[i] += delta;
+		}
+	}
+}
+
+// Whether shifting the ids >= first of a grid over n items is cheaper with one
+// pass over every cell than with a relabel per moved item
+inline bool sweep_cheaper(int first, int n) {
+	return (n - first) * 8 > n;
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t TriangleGrid::key(int x, int y) {
+	return ((uint64_t) (uint32_t) x << 32) | (uint64_t) (uint32_t) y;
+}
+
+int TriangleGrid::cell_coord(float v) const {
+	return (int) std::floor(v / cell_size);
+}
+
+TriangleGrid::Box TriangleGrid::bounds(const TriangleStore &store, int t) {
+	const float *p = store.position_data() + t * 9;
+	float x0 = std::min(p[0], std::min(p[3], p[6])), x1 = std::max(p[0], std::max(p[3], p[6]));
+	float y0 = std::min(p[1], std::min(p[4], p[7])), y1 = std::max(p[1], std::max(p[4], p[7]));
+	extent[0] = std::min(extent[0], x0);
+	extent[1] = std::min(extent[1], y0);
+	extent[2] = std::max(extent[2], x1);
+	extent[3] = std::max(extent[3], y1);
+	Box b;
+	b.x0 = cell_coord(x0);
+	b.y0 = cell_coord(y0);
+	b.x1 = cell_coord(x1);
+	b.y1 = cell_coord(y1);
+	if ((int64_t) (b.x1 - b.x0 + 1) * (b.y1 - b.y0 + 1) > max_cells_per_triangle) {
+		b.x0 = 1;
+		b.x1 = 0;
+	}
+	return b;
+}
+
+void TriangleGrid::link(const Box &b, int t) {
+	if (b.x0 > b.x1) {
+		large.push_back(t);
+		return;
+	}
+	for (int y = b.y0; y <= b.y1; ++y) {
+		for (int x = b.x0; x <= b.x1; ++x) {
+			cells[key(x, y)].push_back(t);
+		}
+	}
+}
+
+void TriangleGrid::unlink(const Box &b, int t) {
+	if (b.x0 > b.x1) {
+		erase_value(large, t);
+		return;
+	}
+	for (int y = b.y0; y <= b.y1; ++y) {
+		for (int x = b.x0; x <= b.x1; ++x) {
+			std::unordered_map<uint64_t, std::vector<int> >::iterator c = cells.find(key(x, y));
+			erase_value(c->second, t);
+			if (c->second.empty()) {
+				cells.erase(c);
+			}
+		}
+	}
+}
+
+void TriangleGrid::relabel(const Box &b, int from, int to) {
+	if (b.x0 > b.x1) {
+		replace_value(large, from, to);
+		return;
+	}
+	for (int y = b.y0; y <= b.y1; ++y) {
+		for (int x = b.x0; x <= b.x1; ++x) {
+			replace_value(cells[key(x, y)], from, to);
+		}
+	}
+}
+
+void TriangleGrid::build(const TriangleStore &store, int n, float cell_size) {
+	clear();
+	if (cell_size <= 0 && n > 0) {
+		// Aim for cells about twice as large as an average triangle
+		double extent = 0;
+		for (int t = 0; t < n; ++t) {
+			const float *p = store.position_data() + t * 9;
+			float w = std::max(p[0], std::max(p[3], p[6])) - std::min(p[0], std::min(p[3], p[6]));
+			float h = std::max(p[1], std::max(p[4], p[7])) - std::min(p[1], std::min(p[4], p[7]));
+			extent += std::max(w, h);
+		}
+		cell_size = (float) (2.0 * extent / n);
+	}
+	if (cell_size > 0) {
+		this->cell_size = cell_size;
+	}
+
+	boxes.reserve(n);
+	cells.reserve(n);
+	for (int t = 0; t < n; ++t) {
+		append(store);
+	}
+}
+
+void TriangleGrid::append(const TriangleStore &store) {
+	int t = size();
+	assert(t < store.size());
+	Box b = bounds(store, t);
+	boxes.push_back(b);
+	link(b, t);
+}
+
+void TriangleGrid::update(const TriangleStore &store, int t) {
+	assert(t >= 0 && t < size());
+	Box b = bounds(store, t);
+	const Box &old = boxes[t];
+	// Small moves usually stay inside the same cells
+	if (b.x0 == old.x0 && b.y0 == old.y0 && b.x1 == old.x1 && b.y1 == old.y1) {
+		return;
+	}
+	unlink(old, t);
+	link(b, t);
+	boxes[t] = b;
+}
+
+void TriangleGrid::insert(const TriangleStore &store, int t) {
+	assert(t >= 0 && t <= size() && size() < store.size());
+	shift(t, 1);
+	Box b = bounds(store, t);
+	boxes.insert(boxes.begin() + t, b);
+	link(b, t);
+}
+
+void TriangleGrid::erase(int t) {
+	assert(t >= 0 && t < size());
+	unlink(boxes[t], t);
+	boxes.erase(boxes.begin() + t);
+	shift(t + 1, -1);
+}
+
+void TriangleGrid::shift(int first, int delta) {
+	// The triangles from first are still labelled with their old index
+	int n = (int) boxes.size() + (delta < 0 ? 1 : 0);
+	if (sweep_cheaper(first, n)) {
+		for (std::unordered_map<uint64_t, std::vector<int> >::iterator c = cells.begin(); c != cells.end(); ++c) {
+			shift_ids(c->second, first, delta);
+		}
+		shift_ids(large, first, delta);
+	} else if (delta > 0) {
+		// Move the highest first so that the labels never collide
+		for (int t = n - 1; t >= first; --t) {
+			relabel(boxes[t], t, t + delta);
+		}
+	} else {
+		for (int t = first; t < n; ++t) {
+			relabel(boxes[t + delta], t, t + delta);
+		}
+	}
+}
+
+void TriangleGrid::clear() {
+	cells.clear();
+	boxes.clear();
+	large.clear();
+	extent[0] = extent[1] = std::numeric_limits<float>::max();
+	extent[2] = extent[3] = -std::numeric_limits<float>::max();
+}
+
+int TriangleGrid::pick(const TriangleStore &store, float x, float y) const {
+	// Later triangles are drawn on top, so the highest index wins
+	int best = -1;
+	std::unordered_map<uint64_t, std::vector<int> >::const_iterator c = cells.find(key(cell_coord(x), cell_coord(y)));
+	if (c != cells.end()) {
+		best = hit_test_topmost(store, c->second.data(), (int) c->second.size(), x, y);
+	}
+	if (!large.empty()) {
+		best = std::max(best, hit_test_topmost(store, large.data(), (int) large.size(), x, y));
+	}
+	return best;
+}
+
+template <typename F>
+void TriangleGrid::for_each_cell(float x0, float y0, float x1, float y1, F f) const {
+	int cx0 = cell_coord(x0), cy0 = cell_coord(y0);
+	int cx1 = cell_coord(x1), cy1 = cell_coord(y1);
+	if ((int64_t) (cx1 - cx0 + 1) * (cy1 - cy0 + 1) > (int64_t) cells.size()) {
+		// Rectangle larger than the populated area, walk the cells instead
+		for (std::unordered_map<uint64_t, std::vector<int> >::const_iterator c = cells.begin(); c != cells.end(); ++c) {
+			int x = (int) (int32_t) (uint32_t) (c->first >> 32);
+			int y = (int) (int32_t) (uint32_t) (c->first & 0xffffffffu);
+			if (x >= cx0 && x <= cx1 && y >= cy0 && y <= cy1) {
+				f(c->second);
+			}
+		}
+	} else {
+		for (int y = cy0; y <= cy1; ++y) {
+			for (int x = cx0; x <= cx1; ++x) {
+				std::unordered_map<uint64_t, std::vector<int> >::const_iterator c = cells.find(key(x, y));
+				if (c != cells.end()) {
+					f(c->second);
+				}
+			}
+		}
+	}
+}
+
+void TriangleGrid::query(float x0, float y0, float x1, float y1, std::vector<int> &out) const {
+	size_t first = out.size();
+	for_each_cell(x0, y0, x1, y1, [&](const std::vector<int> &cell) {
+		out.insert(out.end(), cell.begin(), cell.end());
+	});
+	out.insert(out.end(), large.begin(), large.end());
+
+	// A triangle spanning several cells was added once per cell
+	std::sort(out.begin() + first, out.end());
+	out.erase(std::unique(out.begin() + first, out.end()), out.end());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t VertexGrid::key(int x, int y) {
+	return ((uint64_t) (uint32_t) x << 32) | (uint64_t) (uint32_t) y;
+}
+
+int VertexGrid::cell_coord(float v) const {
+	return (int) std::floor(v / cell_size);
+}
+
+uint64_t VertexGrid::key_of(const TriangleStore &store, int v) const {
+	const float *p = store.position_data() + v * 3;
+	return key(cell_coord(p[0]), cell_coord(p[1]));
+}
+
+void VertexGrid::link(uint64_t k, int v) {
+	cells[k].push_back(v);
+}
+
+void VertexGrid::unlink(uint64_t k, int v) {
+	std::unordered_map<uint64_t, std::vector<int> >::iterator c = cells.find(k);
+	erase_value(c->second, v);
+	if (c->second.empty()) {
+		cells.erase(c);
+	}
+}
+
+void VertexGrid::relabel(uint64_t k, int from, int to) {
+	replace_value(cells[k], from, to);
+}
+
+void VertexGrid::build(const TriangleStore &store, int n, float cell_size) {
+	clear();
+	if (cell_size <= 0 && n > 0) {
+		// Vertices of neighbouring triangles are about a triangle apart, so aim
+		// for cells half as large as an average triangle. Small triangles spread
+		// over a large area get cells of a few vertices instead.
+		double extent = 0;
+		Eigen::Vector2f min = store.positions.col(0).head<2>(), max = min;
+		for (int t = 0; t < n; ++t) {
+			const float *p = store.position_data() + t * 9;
+			float x0 = std::min(p[0], std::min(p[3], p[6])), x1 = std::max(p[0], std::max(p[3], p[6]));
+			float y0 = std::min(p[1], std::min(p[4], p[7])), y1 = std::max(p[1], std::max(p[4], p[7]));
+			extent += std::max(x1 - x0, y1 - y0);
+			min = min.cwiseMin(Eigen::Vector2f(x0, y0));
+			max = max.cwiseMax(Eigen::Vector2f(x1, y1));
+		}
+		double area = (double) (max[0] - min[0]) * (max[1] - min[1]);
+		cell_size = (float) std::max(0.5 * extent / n, std::sqrt(area * 2 / (3.0 * n)));
+	}
+	if (cell_size > 0) {
+		this->cell_size = cell_size;
+	}
+	keys.reserve(n * 3);
+	cells.reserve(n * 3);
+	for (int t = 0; t < n; ++t) {
+		append(store);
+	}
+}
+
+void VertexGrid::append(const TriangleStore &store) {
+	assert(size() < store.size());
+	for (int k = 0; k < 3; ++k) {
+		int v = (int) keys.size();
+		keys.push_back(key_of(store, v));
+		link(keys.back(), v);
+	}
+}
+
+void VertexGrid::update(const TriangleStore &store, int t) {
+	assert(t >= 0 && t < size());
+	for (int v = t * 3; v < t * 3 + 3; ++v) {
+		uint64_t k = key_of(store, v);
+		if (k != keys[v]) {
+			unlink(keys[v], v);
+			link(k, v);
+			keys[v] = k;
+		}
+	}
+}
+
+void VertexGrid::insert(const TriangleStore &store, int t) {
+	assert(t >= 0 && t <= size() && size() < store.size());
+	shift(t * 3, 3);
+	keys.insert(keys.begin() + t * 3, 3, 0);
+	for (int v = t * 3; v < t * 3 + 3; ++v) {
+		keys[v] = key_of(store, v);
+		link(keys[v], v);
+	}
+}
+
+void VertexGrid::erase(int t) {
+	assert(t >= 0 && t < size());
+	for (int v = t * 3; v < t * 3 + 3; ++v) {
+		unlink(keys[v], v);
+	}
+	keys.erase(keys.begin() + t * 3, keys.begin() + t * 3 + 3);
+	shift(t * 3 + 3, -3);
+}
+
+void VertexGrid::shift(int first, int delta) {
+	// The vertices from first are still labelled with their old index
+	int n = (int) keys.size() + (delta < 0 ? 3 : 0);
+	if (sweep_cheaper(first, n)) {
+		for (std::unordered_map<uint64_t, std::vector<int> >::iterator c = cells.begin(); c != cells.end(); ++c) {
+			shift_ids(c->second, first, delta);
+		}
+	} else if (delta > 0) {
+		for (int v = n - 1; v >= first; --v) {
+			relabel(keys[v], v, v + delta);
+		}
+	} else {
+		for (int v = first; v < n; ++v) {
+			relabel(keys[v + delta], v, v + delta);
+		}
+	}
+}
+
+void VertexGrid::clear() {
+	cells.clear();
+	keys.clear();
+}
+
+int VertexGrid::nearest(const TriangleStore &store, float x, float y, float radius) const {
+	int best = -1;
+	float best_d2 = radius * radius;
+	int cx = cell_coord(x), cy = cell_coord(y);
+	int rings = (int) std::ceil(radius / cell_size);
+
+	// Visit the cells in rings of growing distance around the query point and
+	// stop once a ring cannot contain anything closer than the current best
+	for (int r = 0; r <= rings; ++r) {
+		if (r > 0 && (r - 1) * cell_size > std::sqrt(best_d2)) {
+			break;
+		}
+		if ((int64_t) (2 * r + 1) * (2 * r + 1) > 4 * (int64_t) cells.size() + 64) {
+			// The ring is larger than the populated area, scan every cell
+			for (std::unordered_map<uint64_t, std::vector<int> >::const_iterator c = cells.begin(); c != cells.end(); ++c) {
+				for (size_t i = 0; i < c->second.size(); ++i) {
+					int v = c->second[i];
+					const float *p = store.position_data() + v * 3;
+					float d2 = (p[0] - x) * (p[0] - x) + (p[1] - y) * (p[1] - y);
+					if (d2 < best_d2 || (d2 == best_d2 && v > best)) {
+						best_d2 = d2;
+						best = v;
+					}
+				}
+			}
+			return best;
+		}
+		for (int j = cy - r; j <= cy + r; ++j) {
+			// Only the border of the square belongs to ring r
+			int step = (j == cy - r || j == cy + r) ? 1 : 2 * r;
+			for (int i = cx - r; i <= cx + r; i += std::max(step, 1)) {
+				std::unordered_map<uint64_t, std::vector<int> >::const_iterator c = cells.find(key(i, j));
+				if (c == cells.end()) {
+					continue;
+				}
+				for (size_t n = 0; n < c->second.size(); ++n) {
+					int v = c->second[n];
+					const float *p = store.position_data() + v * 3;
+					float d2 = (p[0] - x) * (p[0] - x) + (p[1] - y) * (p[1] - y);
+					if (d2 < best_d2 || (d2 == best_d2 && v > best)) {
+						best_d2 = d2;
+						best = v;
+					}
+				}
+			}
+		}
+	}
+	return best;
+}
+
+bool TriangleGrid::covers(float x0, float y0, float x1, float y1) const {
+	return x0 <= extent[0] && y0 <= extent[1] && x1 >= extent[2] && y1 >= extent[3];
+}
+
+void TriangleGrid::visible(float x0, float y0, float x1, float y1, std::vector<unsigned int> &vertices) const {
+	// Mark the triangles of the cells, a triangle spanning several cells is
+	// marked once, and read them back in order a word at a time
+	marks.assign((boxes.size() + 63) / 64, 0);
+	for_each_cell(x0, y0, x1, y1, [&](const std::vector<int> &cell) {
+		for (size_t i = 0; i < cell.size(); ++i) {
+			marks[cell[i] >> 6] |= (uint64_t) 1 << (cell[i] & 63);
+		}
+	});
+	for (size_t i = 0; i < large.size(); ++i) {
+		marks[large[i] >> 6] |= (uint64_t) 1 << (large[i] & 63);
+	}
+
+	vertices.clear();
+	for (size_t w = 0; w < marks.size(); ++w) {
+		for (uint64_t bits = marks[w]; bits; bits &= bits - 1) {
+			unsigned int t = (unsigned int) (w * 64 + lowest_bit(bits));
+			vertices.push_back(t * 3);
+			vertices.push_back(t * 3 + 1);
+			vertices.push_back(t * 3 + 2);
+		}
+	}
+}
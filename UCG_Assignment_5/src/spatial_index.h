@@ -0,0 +1,143 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "hit_test.h"
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+////////////////////////////////////////////////////////////////////////////////
+
+// Hashed uniform grid over the first size() triangles of a TriangleStore.
+//
+// Every triangle is registered in the cells overlapped by its bounding box.
+// The grid mirrors the index operations of TriangleStore (append, insert,
+// erase) so that it can be kept up to date incrementally, and update() has
+// to be called whenever the vertices of a triangle change. Triangles that
+// cover too many cells are kept in a separate list tested on every query.
+class TriangleGrid {
+public:
+	// Maximum number of cells a triangle is registered in
+	static const int max_cells_per_triangle = 256;
+
+	TriangleGrid() : cell_size(0.1f) { clear(); }
+
+	// Number of triangles indexed
+	int size() const { return (int) boxes.size(); }
+
+	float cell() const { return cell_size; }
+
+	// Index the first n triangles of store with the given cell size
+	// (a size <= 0 picks one from the average triangle extent)
+	void build(const TriangleStore &store, int n, float cell_size = 0);
+
+	// Index triangle size(), which must exist in store
+	void append(const TriangleStore &store);
+
+	// Triangle t was modified in store
+	void update(const TriangleStore &store, int t);
+
+	// Same as TriangleStore::insert / TriangleStore::erase, the indices of the
+	// triangles after t move by one
+	void insert(const TriangleStore &store, int t);
+	void erase(int t);
+
+	void clear();
+
+	// Topmost (highest index) triangle containing (x, y), -1 if none
+	int pick(const TriangleStore &store, float x, float y) const;
+
+	// Append to out the triangles whose bounding box may overlap the rectangle
+	void query(float x0, float y0, float x1, float y1, std::vector<int> &out) const;
+
+	// Whether the rectangle contains every indexed triangle (the bounds only
+	// grow between two builds, so this may miss after deletions)
+	bool covers(float x0, float y0, float x1, float y1) const;
+
+	// Set vertices to the indices of the vertices of the triangles whose
+	// bounding box may overlap the rectangle, in increasing order so that they
+	// are drawn in the order of the store. The cost grows with the number of
+	// those triangles, plus one bit per indexed triangle.
+	void visible(float x0, float y0, float x1, float y1, std::vector<unsigned int> &vertices) const;
+
+private:
+	// Inclusive range of cells covered by a triangle, x0 > x1 marks an
+	// oversized triangle stored in the large list instead
+	struct Box {
+		int x0, y0, x1, y1;
+	};
+
+	float cell_size;
+	std::unordered_map<uint64_t, std::vector<int> > cells;
+	std::vector<Box> boxes;
+	std::vector<int> large;
+	// Bounds of every triangle indexed since the last build or clear
+	float extent[4];
+	// One bit per triangle, scratch of visible()
+	mutable std::vector<uint64_t> marks;
+
+	Box bounds(const TriangleStore &store, int t);
+	int cell_coord(float v) const;
+	static uint64_t key(int x, int y);
+
+	void link(const Box &b, int t);
+	void unlink(const Box &b, int t);
+	void relabel(const Box &b, int from, int to);
+	// Add delta to the labels of the triangles from first
+	void shift(int first, int delta);
+
+	// Call f on the list of every populated cell overlapping the rectangle
+	template <typename F>
+	void for_each_cell(float x0, float y0, float x1, float y1, F f) const;
+};
+
+// -----------------------------------------------------------------------------
+
+// Hashed uniform grid over the vertices of the first size() triangles of a
+// TriangleStore, used for nearest-vertex queries. It is kept up to date the
+// same way as TriangleGrid.
+class VertexGrid {
+public:
+	VertexGrid() : cell_size(0.05f) { }
+
+	// Number of triangles indexed (3 vertices each)
+	int size() const { return (int) keys.size() / 3; }
+
+	float cell() const { return cell_size; }
+
+	// Index the vertices of the first n triangles of store with the given cell
+	// size (a size <= 0 picks one from the vertex spacing)
+	void build(const TriangleStore &store, int n, float cell_size = 0);
+
+	// Index the vertices of triangle size(), which must exist in store
+	void append(const TriangleStore &store);
+
+	// The vertices of triangle t were modified in store
+	void update(const TriangleStore &store, int t);
+
+	// Same as TriangleStore::insert / TriangleStore::erase
+	void insert(const TriangleStore &store, int t);
+	void erase(int t);
+
+	void clear();
+
+	// Index of the vertex closest to (x, y) among those within radius,
+	// -1 if there is none. Ties go to the highest index (the triangle on top).
+	int nearest(const TriangleStore &store, float x, float y, float radius) const;
+
+private:
+	float cell_size;
+	std::unordered_map<uint64_t, std::vector<int> > cells;
+	// Cell of every indexed vertex
+	std::vector<uint64_t> keys;
+
+	uint64_t key_of(const TriangleStore &store, int v) const;
+	int cell_coord(float v) const;
+	static uint64_t key(int x, int y);
+
+	void link(uint64_t k, int v);
+	void unlink(uint64_t k, int v);
+	void relabel(uint64_t k, int from, int to);
+	// Add delta to the labels of the vertices from first
+	void shift(int first, int delta);
+};
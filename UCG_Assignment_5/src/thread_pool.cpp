@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "thread_pool.h"
+#include <algorithm>
+////////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool(int threads)
+	: task(0), count(0), chunk(0), next(0), open(false), generation(0), active(0), stopping(false)
+{
+	if (threads <= 0) {
+		threads = std::max(1, (int) std::thread::hardware_concurrency());
+	}
+	for (int i = 1; i < threads; ++i) {
+		workers.push_back(std::thread(&ThreadPool::work, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+}
+
+void ThreadPool::run_chunks(const std::function<void(int, int)> &f, int count, int chunk) {
+	for (;;) {
+		int begin = next.fetch_add(chunk);
+		if (begin >= count) {
+			return;
+		}
+		f(begin, std::min(count, begin + chunk));
+	}
+}
+
+void ThreadPool::work() {
+	unsigned int seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		wake.wait(lock, [&] { return stopping || (open && generation != seen); });
+		if (stopping) {
+			return;
+		}
+		seen = generation;
+		const std::function<void(int, int)> &f = *task;
+		int n = count, c = chunk;
+		++active;
+		lock.unlock();
+
+		run_chunks(f, n, c);
+
+		lock.lock();
+		if (--active == 0) {
+			done.notify_all();
+		}
+	}
+}
+
+void ThreadPool::parallel_for(int n, int grain, const std::function<void(int, int)> &f) {
+	if (n <= 0) {
+		return;
+	}
+	grain = std::max(1, grain);
+	if (workers.empty() || n < 2 * grain) {
+		f(0, n);
+		return;
+	}
+
+	std::lock_guard<std::mutex> serial(loop);
+
+	// A few chunks per thread balance the load without much scheduling cost
+	int chunks = std::min(n / grain, size() * 4);
+	int c = (n + chunks - 1) / chunks;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &f;
+		count = n;
+		chunk = c;
+		next = 0;
+		open = true;
+		++generation;
+	}
+	wake.notify_all();
+
+	run_chunks(f, n, c);
+
+	// Every chunk has been taken, close the loop and wait for the workers that
+	// are still running one
+	std::unique_lock<std::mutex> lock(mutex);
+	open = false;
+	done.wait(lock, [&] { return active == 0; });
+	task = 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+// Fixed set of worker threads running one parallel loop at a time.
+//
+// The calling thread takes part in the loop, so a pool of size() == 1 has no
+// worker and runs everything inline.
+class ThreadPool {
+public:
+	// Use the given number of threads including the caller, 0 for one per core
+	explicit ThreadPool(int threads = 0);
+	~ThreadPool();
+
+	// Number of threads a loop is split across, including the caller
+	int size() const { return (int) workers.size() + 1; }
+
+	// Call f(begin, end) on consecutive chunks of [0, n) of at least grain
+	// items and return once every chunk is done. Loops smaller than two chunks
+	// run on the calling thread only.
+	void parallel_for(int n, int grain, const std::function<void(int, int)> &f);
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	// Loop being run, workers only join it while open is set
+	const std::function<void(int, int)> *task;
+	int count;
+	int chunk;
+	std::atomic<int> next;
+	bool open;
+	unsigned int generation;
+	int active;
+	bool stopping;
+
+	// Serializes parallel_for calls made from different threads
+	std::mutex loop;
+
+	void run_chunks(const std::function<void(int, int)> &f, int count, int chunk);
+	void work();
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
@@ -0,0 +1,50 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "timeline.h"
+#include <algorithm>
+#include <cmath>
+////////////////////////////////////////////////////////////////////////////////
+
+void Timeline::set_length(double seconds) {
+	duration = std::max(0.0, seconds);
+	time = std::min(time, duration);
+}
+
+void Timeline::play() {
+	if (time >= duration) {
+		time = 0;
+	}
+	playing = duration > 0;
+}
+
+void Timeline::toggle() {
+	if (playing) {
+		pause();
+	} else {
+		play();
+	}
+}
+
+void Timeline::stop() {
+	playing = false;
+	time = 0;
+}
+
+void Timeline::seek(double seconds) {
+	time = std::min(std::max(seconds, 0.0), duration);
+}
+
+bool Timeline::advance(double dt) {
+	if (!playing || dt <= 0) {
+		return false;
+	}
+	time += dt;
+	if (time >= duration) {
+		if (looping && duration > 0) {
+			time = std::fmod(time, duration);
+		} else {
+			time = duration;
+			playing = false;
+		}
+	}
+	return true;
+}
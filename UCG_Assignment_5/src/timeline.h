@@ -0,0 +1,43 @@
+#pragma once
+
+// Playback clock of the keyframe animations.
+//
+// The main loop advances it with the wall-clock time elapsed since its previous
+// iteration, so playback runs at the same speed whatever the frame rate and
+// never holds up event processing. Seeking works whether it is playing or not.
+class Timeline {
+public:
+	Timeline() : time(0), duration(0), playing(false), looping(false) { }
+
+	// Current time and length of the animation, in seconds
+	double current() const { return time; }
+	double length() const { return duration; }
+
+	bool is_playing() const { return playing; }
+
+	// Change the length, the current time is clamped to it
+	void set_length(double seconds);
+
+	// Restart from the beginning when the end is reached instead of stopping
+	void set_looping(bool loop) { looping = loop; }
+
+	// Start or resume playback, from the beginning if the end was reached
+	void play();
+	void pause() { playing = false; }
+	void toggle();
+
+	// Pause and rewind to the beginning
+	void stop();
+
+	// Jump to the given time (clamped to the animation)
+	void seek(double seconds);
+
+	// Move forward by dt seconds if playing, returns true if the time changed
+	bool advance(double dt);
+
+private:
+	double time;
+	double duration;
+	bool playing;
+	bool looping;
+};
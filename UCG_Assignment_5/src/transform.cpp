@@ -0,0 +1,307 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "transform.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <Eigen/LU>
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Number of triangles gathered in structure-of-arrays form per kernel call,
+// a multiple of the widest vector
+const int block_size = 64;
+
+// Offsets of the six coordinate arrays inside a gathered block
+enum { X0 = 0, Y0 = 1, X1 = 2, Y1 = 3, X2 = 4, Y2 = 5 };
+
+// Transform flattened for the kernels: p' = [a b; c d] p + o, where o is
+// computed per triangle from its barycenter, or once from the shared pivot
+struct Coefficients {
+	float a, b, c, d;
+	float tx, ty;
+	bool barycenter;
+	float ox, oy;
+};
+
+typedef void (*BlockKernel)(float *block, int n, const Coefficients &k);
+
+void block_scalar(float *block, int n, const Coefficients &k) {
+	const float third = 1.0f / 3.0f;
+	for (int i = 0; i < n; ++i) {
+		float *x0 = block + X0 * block_size + i, *y0 = block + Y0 * block_size + i;
+		float *x1 = block + X1 * block_size + i, *y1 = block + Y1 * block_size + i;
+		float *x2 = block + X2 * block_size + i, *y2 = block + Y2 * block_size + i;
+		float ox = k.ox, oy = k.oy;
+		if (k.barycenter) {
+			float cx = (*x0 + *x1 + *x2) * third;
+			float cy = (*y0 + *y1 + *y2) * third;
+			ox = cx + k.tx - (k.a * cx + k.b * cy);
+			oy = cy + k.ty - (k.c * cx + k.d * cy);
+		}
+		float x, y;
+		x = *x0; y = *y0;
+		*x0 = k.a * x + k.b * y + ox; *y0 = k.c * x + k.d * y + oy;
+		x = *x1; y = *y1;
+		*x1 = k.a * x + k.b * y + ox; *y1 = k.c * x + k.d * y + oy;
+		x = *x2; y = *y2;
+		*x2 = k.a * x + k.b * y + ox; *y2 = k.c * x + k.d * y + oy;
+	}
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse2")
+void block_sse2(float *block, int n, const Coefficients &k) {
+	const __m128 a = _mm_set1_ps(k.a), b = _mm_set1_ps(k.b);
+	const __m128 c = _mm_set1_ps(k.c), d = _mm_set1_ps(k.d);
+	const __m128 tx = _mm_set1_ps(k.tx), ty = _mm_set1_ps(k.ty);
+	const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+	for (int i = 0; i < n; i += 4) {
+		float *p[6];
+		__m128 v[6];
+		for (int j = 0; j < 6; ++j) {
+			p[j] = block + j * block_size + i;
+			v[j] = _mm_load_ps(p[j]);
+		}
+		__m128 ox = _mm_set1_ps(k.ox), oy = _mm_set1_ps(k.oy);
+		if (k.barycenter) {
+			__m128 cx = _mm_mul_ps(_mm_add_ps(_mm_add_ps(v[X0], v[X1]), v[X2]), third);
+			__m128 cy = _mm_mul_ps(_mm_add_ps(_mm_add_ps(v[Y0], v[Y1]), v[Y2]), third);
+			ox = _mm_sub_ps(_mm_add_ps(cx, tx), _mm_add_ps(_mm_mul_ps(a, cx), _mm_mul_ps(b, cy)));
+			oy = _mm_sub_ps(_mm_add_ps(cy, ty), _mm_add_ps(_mm_mul_ps(c, cx), _mm_mul_ps(d, cy)));
+		}
+		for (int j = 0; j < 6; j += 2) {
+			__m128 x = v[j], y = v[j + 1];
+			_mm_store_ps(p[j], _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, x), _mm_mul_ps(b, y)), ox));
+			_mm_store_ps(p[j + 1], _mm_add_ps(_mm_add_ps(_mm_mul_ps(c, x), _mm_mul_ps(d, y)), oy));
+		}
+	}
+}
+
+SIMD_TARGET("avx2")
+void block_avx2(float *block, int n, const Coefficients &k) {
+	const __m256 a = _mm256_set1_ps(k.a), b = _mm256_set1_ps(k.b);
+	const __m256 c = _mm256_set1_ps(k.c), d = _mm256_set1_ps(k.d);
+	const __m256 tx = _mm256_set1_ps(k.tx), ty = _mm256_set1_ps(k.ty);
+	const __m256 third = _mm256_set1_ps(1.0f / 3.0f);
+	for (int i = 0; i < n; i += 8) {
+		float *p[6];
+		__m256 v[6];
+		for (int j = 0; j < 6; ++j) {
+			p[j] = block + j * block_size + i;
+			v[j] = _mm256_load_ps(p[j]);
+		}
+		__m256 ox = _mm256_set1_ps(k.ox), oy = _mm256_set1_ps(k.oy);
+		if (k.barycenter) {
+			__m256 cx = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(v[X0], v[X1]), v[X2]), third);
+			__m256 cy = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(v[Y0], v[Y1]), v[Y2]), third);
+			ox = _mm256_sub_ps(_mm256_add_ps(cx, tx), _mm256_add_ps(_mm256_mul_ps(a, cx), _mm256_mul_ps(b, cy)));
+			oy = _mm256_sub_ps(_mm256_add_ps(cy, ty), _mm256_add_ps(_mm256_mul_ps(c, cx), _mm256_mul_ps(d, cy)));
+		}
+		for (int j = 0; j < 6; j += 2) {
+			__m256 x = v[j], y = v[j + 1];
+			_mm256_store_ps(p[j], _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, x), _mm256_mul_ps(b, y)), ox));
+			_mm256_store_ps(p[j + 1], _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c, x), _mm256_mul_ps(d, y)), oy));
+		}
+	}
+}
+
+#endif // SIMD_X86
+
+BlockKernel block_kernel(SimdLevel k) {
+	switch (k) {
+#ifdef SIMD_X86
+		case SimdSSE2: return block_sse2;
+		case SimdAVX2: return block_avx2;
+#endif
+		default: return block_scalar;
+	}
+}
+
+// Kernel in use, detected on the first call
+SimdLevel &active_kernel() {
+	static SimdLevel k = simd_best();
+	return k;
+}
+
+BlockKernel &active_block() {
+	static BlockKernel f = block_kernel(active_kernel());
+	return f;
+}
+
+Coefficients flatten(const TriangleTransform &m) {
+	Coefficients k;
+	k.a = m.linear(0, 0);
+	k.b = m.linear(0, 1);
+	k.c = m.linear(1, 0);
+	k.d = m.linear(1, 1);
+	k.tx = m.offset[0];
+	k.ty = m.offset[1];
+	k.barycenter = m.about_barycenter;
+	Eigen::Vector2f o = m.pivot + m.offset - m.linear * m.pivot;
+	k.ox = o[0];
+	k.oy = o[1];
+	return k;
+}
+
+// Compose the transform of one triangle with k, (cx, cy) being its barycenter
+// before the transform
+void compose(float *t, float cx, float cy, const Coefficients &k) {
+	float ox = k.ox, oy = k.oy;
+	if (k.barycenter) {
+		ox = cx + k.tx - (k.a * cx + k.b * cy);
+		oy = cy + k.ty - (k.c * cx + k.d * cy);
+	}
+	float a = t[0], c = t[1], b = t[2], d = t[3], tx = t[4], ty = t[5];
+	t[0] = k.a * a + k.b * c;
+	t[1] = k.c * a + k.d * c;
+	t[2] = k.a * b + k.b * d;
+	t[3] = k.c * b + k.d * d;
+	t[4] = k.a * tx + k.b * ty + ox;
+	t[5] = k.c * tx + k.d * ty + oy;
+}
+
+// Transform the triangles of one chunk, block by block, and compose their
+// transforms. Triangle i of the chunk is triangles[i], or first + i when
+// triangles is null.
+void transform_chunk(float *positions, float *transforms, const int *triangles, int first, int n,
+	const Coefficients &k)
+{
+	alignas(32) float block[6 * block_size] = { 0 };
+	BlockKernel kernel = active_block();
+	for (int i = 0; i < n; i += block_size) {
+		int m = std::min(block_size, n - i);
+		for (int j = 0; j < m; ++j) {
+			const float *p = positions + (triangles ? triangles[i + j] : first + i + j) * 9;
+			block[X0 * block_size + j] = p[0];
+			block[Y0 * block_size + j] = p[1];
+			block[X1 * block_size + j] = p[3];
+			block[Y1 * block_size + j] = p[4];
+			block[X2 * block_size + j] = p[6];
+			block[Y2 * block_size + j] = p[7];
+		}
+		const float third = 1.0f / 3.0f;
+		for (int j = 0; j < m; ++j) {
+			int t = triangles ? triangles[i + j] : first + i + j;
+			float cx = (block[X0 * block_size + j] + block[X1 * block_size + j] + block[X2 * block_size + j]) * third;
+			float cy = (block[Y0 * block_size + j] + block[Y1 * block_size + j] + block[Y2 * block_size + j]) * third;
+			compose(transforms + t * 6, cx, cy, k);
+		}
+
+		// Round up to the widest vector, the padding lanes are not written back
+		kernel(block, (m + 7) & ~7, k);
+
+		for (int j = 0; j < m; ++j) {
+			float *p = positions + (triangles ? triangles[i + j] : first + i + j) * 9;
+			p[0] = block[X0 * block_size + j];
+			p[1] = block[Y0 * block_size + j];
+			p[3] = block[X1 * block_size + j];
+			p[4] = block[Y1 * block_size + j];
+			p[6] = block[X2 * block_size + j];
+			p[7] = block[Y2 * block_size + j];
+		}
+	}
+}
+
+void transform(TriangleStore &store, const int *triangles, int first, int n, const TriangleTransform &m,
+	ThreadPool *pool)
+{
+	Coefficients k = flatten(m);
+	float *positions = store.positions.data();
+	float *transforms = store.transforms.data();
+	if (pool) {
+		pool->parallel_for(n, transform_grain, [&](int begin, int end) {
+			transform_chunk(positions, transforms, triangles ? triangles + begin : 0, first + begin, end - begin, k);
+		});
+	} else {
+		transform_chunk(positions, transforms, triangles, first, n, k);
+	}
+}
+
+} // anonymous namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+TriangleTransform::TriangleTransform()
+	: linear(Eigen::Matrix2f::Identity())
+	, offset(Eigen::Vector2f::Zero())
+	, about_barycenter(true)
+	, pivot(Eigen::Vector2f::Zero())
+{ }
+
+TriangleTransform TriangleTransform::rotation(float radians) {
+	TriangleTransform m;
+	float c = std::cos(radians), s = std::sin(radians);
+	m.linear << c, -s, s, c;
+	return m;
+}
+
+TriangleTransform TriangleTransform::scaling(float factor) {
+	TriangleTransform m;
+	m.linear *= factor;
+	return m;
+}
+
+TriangleTransform TriangleTransform::translation(const Eigen::Vector2f &offset) {
+	TriangleTransform m;
+	m.offset = offset;
+	return m;
+}
+
+TriangleTransform TriangleTransform::about(const Eigen::Vector2f &pivot) const {
+	TriangleTransform m = *this;
+	m.about_barycenter = false;
+	m.pivot = pivot;
+	return m;
+}
+
+TriangleTransform TriangleTransform::inverse() const {
+	TriangleTransform m = *this;
+	m.linear = linear.inverse();
+	m.offset = about_barycenter ? Eigen::Vector2f(-offset) : Eigen::Vector2f(-(m.linear * offset));
+	return m;
+}
+
+void transform_triangles(TriangleStore &store, int begin, int end, const TriangleTransform &m, ThreadPool *pool) {
+	assert(begin >= 0 && end <= store.size());
+	transform(store, 0, begin, end - begin, m, pool);
+}
+
+void transform_triangles(TriangleStore &store, const int *triangles, int n, const TriangleTransform &m,
+	ThreadPool *pool)
+{
+	transform(store, triangles, 0, n, m, pool);
+}
+
+bool move_triangle(TriangleStore &store, int t, const Eigen::Matrix<float, 2, 3> &vertices) {
+	// Homogeneous vertices before and after, the map is after * before^-1
+	Eigen::Matrix3f before = store.positions.middleCols<3>(t * 3);
+	before.row(2).setOnes();
+	float det = before.determinant();
+	if (std::abs(det) < 1e-12f) {
+		return false;
+	}
+	Eigen::Matrix<float, 2, 3> map = vertices * before.inverse();
+
+	TriangleStore::Affine m = store.transform(t);
+	store.transform(t).leftCols<2>() = map.leftCols<2>() * m.leftCols<2>();
+	store.transform(t).col(2) = map.leftCols<2>() * m.col(2) + map.col(2);
+	for (int k = 0; k < 3; ++k) {
+		store.positions.col(t * 3 + k) << vertices(0, k), vertices(1, k), 1.0f;
+	}
+	return true;
+}
+
+SimdLevel transform_kernel() {
+	return active_kernel();
+}
+
+bool set_transform_kernel(SimdLevel k) {
+	if (!simd_supported(k)) {
+		return false;
+	}
+	active_kernel() = k;
+	active_block() = block_kernel(k);
+	return true;
+}
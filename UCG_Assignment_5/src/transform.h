@@ -0,0 +1,61 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include "thread_pool.h"
+#include "simd.h"
+////////////////////////////////////////////////////////////////////////////////
+
+// Affine transform applied to many triangles at once:
+//
+//     p' = linear * (p - pivot) + pivot + offset
+//
+// where the pivot is either the barycenter of each triangle or a single point
+// shared by all of them. The sine and cosine of a rotation are computed once
+// when the transform is built, never per vertex.
+struct TriangleTransform {
+	Eigen::Matrix2f linear;
+	Eigen::Vector2f offset;
+
+	// Pivot shared by all triangles, only used when about_barycenter is false
+	bool about_barycenter;
+	Eigen::Vector2f pivot;
+
+	TriangleTransform();
+
+	// Counterclockwise rotation / uniform scaling about each barycenter
+	static TriangleTransform rotation(float radians);
+	static TriangleTransform scaling(float factor);
+	static TriangleTransform translation(const Eigen::Vector2f &offset);
+
+	// Same transform about a pivot shared by all triangles
+	TriangleTransform about(const Eigen::Vector2f &pivot) const;
+
+	// Transform that moves the triangles back, about the same pivot (the
+	// barycenters move by offset, so the inverse moves them by -offset)
+	TriangleTransform inverse() const;
+};
+
+// Selections smaller than this are transformed on the calling thread
+const int transform_grain = 16384;
+
+// Transform triangles [begin, end) of store, split across pool when given. Both
+// the positions and the per-triangle transforms of the store are updated.
+void transform_triangles(TriangleStore &store, int begin, int end, const TriangleTransform &m,
+	ThreadPool *pool = 0);
+
+// Transform the n triangles listed in triangles (no duplicates)
+void transform_triangles(TriangleStore &store, const int *triangles, int n, const TriangleTransform &m,
+	ThreadPool *pool = 0);
+
+// Move triangle t to the given vertices (one per column) by composing the affine
+// map from its current vertices to the new ones into its transform. Returns
+// false, leaving the triangle untouched, when the current triangle is degenerate.
+bool move_triangle(TriangleStore &store, int t, const Eigen::Matrix<float, 2, 3> &vertices);
+
+// Kernel used by transform_triangles, the best supported one by default
+SimdLevel transform_kernel();
+
+// Use kernel k from now on, returns false (and keeps the current kernel) if it
+// is not supported
+bool set_transform_kernel(SimdLevel k);
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////
+#include "triangle_store.h"
+#include <cassert>
+#include <algorithm>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+void TriangleStore::reserve(int n) {
+	if (n > capacity()) {
+		grow(n);
+	}
+}
+
+void TriangleStore::grow(int n) {
+	// Double the capacity so that a sequence of appends costs O(1) each
+	int new_capacity = std::max(n, std::max(16, capacity() * 2));
+	positions.conservativeResize(3, new_capacity * 3);
+	colors.conservativeResize(3, new_capacity * 3);
+	states.conservativeResize(1, new_capacity * 3);
+	transforms.conservativeResize(6, new_capacity);
+}
+
+int TriangleStore::append(const Eigen::Vector2f &a, const Eigen::Vector2f &b, const Eigen::Vector2f &c,
+	const Eigen::Vector3f &color)
+{
+	if (count == capacity()) {
+		grow(count + 1);
+	}
+	int t = count++;
+	set(t, a, b, c);
+	colors.col(t * 3 + 0) = color;
+	colors.col(t * 3 + 1) = color;
+	colors.col(t * 3 + 2) = color;
+	set_state(t, Normal);
+	reset_transform(t);
+	return t;
+}
+
+void TriangleStore::resize(int n) {
+	assert(n >= 0);
+	reserve(n);
+	count = n;
+}
+
+void TriangleStore::set(int t, const Eigen::Vector2f &a, const Eigen::Vector2f &b, const Eigen::Vector2f &c) {
+	assert(t >= 0 && t < count);
+	positions.col(t * 3 + 0) << a[0], a[1], 1.0;
+	positions.col(t * 3 + 1) << b[0], b[1], 1.0;
+	positions.col(t * 3 + 2) << c[0], c[1], 1.0;
+}
+
+void TriangleStore::set_state(int t, State s) {
+	assert(t >= 0 && t < count);
+	states.middleCols<3>(t * 3).setConstant((float) s);
+}
+
+bool TriangleStore::transformed(int t) const {
+	assert(t >= 0 && t < count);
+	return transform(t) != Affine::Identity();
+}
+
+void TriangleStore::reset_transform(int t) {
+	assert(t >= 0 && t < count);
+	transform(t) = Affine::Identity();
+}
+
+void TriangleStore::insert(int t, const Eigen::Vector2f &a, const Eigen::Vector2f &b, const Eigen::Vector2f &c,
+	const Eigen::Vector3f &color)
+{
+	assert(t >= 0 && t <= count);
+	int last = append(a, b, c, color);
+	if (t == last) {
+		return;
+	}
+	// Keep the new triangle aside while the others move up
+	Eigen::Matrix<float, 3, 3> p = positions.middleCols<3>(last * 3);
+	move(t, t + 1, last - t);
+	positions.middleCols<3>(t * 3) = p;
+	colors.middleCols<3>(t * 3) = color.replicate<1, 3>();
+	set_state(t, Normal);
+	reset_transform(t);
+}
+
+void TriangleStore::erase(int t) {
+	assert(t >= 0 && t < count);
+	move(t + 1, t, count - t - 1);
+	--count;
+}
+
+void TriangleStore::move(int from, int to, int n) {
+	// The ranges overlap, memmove copies them in the right direction
+	std::memmove(positions.col(to * 3).data(), positions.col(from * 3).data(), sizeof(float) * 9 * n);
+	std::memmove(colors.col(to * 3).data(), colors.col(from * 3).data(), sizeof(float) * 9 * n);
+	std::memmove(states.data() + to * 3, states.data() + from * 3, sizeof(float) * 3 * n);
+	std::memmove(transforms.col(to).data(), transforms.col(from).data(), sizeof(float) * 6 * n);
+}
+
+Eigen::Vector2f TriangleStore::barycenter(int t) const {
+	Eigen::Vector3f sum = positions.col(t * 3 + 0) + positions.col(t * 3 + 1) + positions.col(t * 3 + 2);
+	return Eigen::Vector2f(sum[0], sum[1]) / 3.0f;
+}
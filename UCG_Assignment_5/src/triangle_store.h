@@ -0,0 +1,104 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+#include <Eigen/Core>
+////////////////////////////////////////////////////////////////////////////////
+
+// Growable triangle soup.
+//
+// Every triangle owns three consecutive vertex columns. Positions and colors
+// are kept in two separate streams (one column per vertex) so that each stream
+// is a single contiguous float array that can be uploaded to a VBO, tested
+// against the cursor or transformed in place without repacking.
+class TriangleStore {
+public:
+	typedef Eigen::Matrix<float, 3, Eigen::Dynamic> Stream;
+
+	// (x, y, 1) of every vertex, only the first vertices() columns are valid
+	Stream positions;
+
+	// (r, g, b) of every vertex, only the first vertices() columns are valid
+	Stream colors;
+
+	// Render state of every vertex (see State), drawn by the shader so that
+	// highlighting never touches the color stream
+	Eigen::Matrix<float, 1, Eigen::Dynamic> states;
+
+	// 2x3 affine transform of every triangle (column-major: a, c, b, d, tx, ty).
+	// positions always hold the transformed vertices, this stream records the
+	// motion since the last reset_transform so that the GPU can apply it to the
+	// positions it already has instead of receiving them again.
+	typedef Eigen::Matrix<float, 2, 3> Affine;
+	Eigen::Matrix<float, 6, Eigen::Dynamic> transforms;
+
+	enum State {
+		Normal = 0,
+		Selected = 1,
+		Preview = 2
+	};
+
+	TriangleStore() : count(0) { }
+
+	// Number of triangles / vertices currently stored
+	int size() const { return count; }
+	int vertices() const { return count * 3; }
+
+	// Number of triangles that fit before the streams have to grow
+	int capacity() const { return (int) positions.cols() / 3; }
+
+	// Make room for at least n triangles
+	void reserve(int n);
+
+	// Append a triangle in the Normal state and return its index (amortized O(1))
+	int append(const Eigen::Vector2f &a, const Eigen::Vector2f &b, const Eigen::Vector2f &c,
+		const Eigen::Vector3f &color);
+
+	// Overwrite the three vertices of triangle t, colors are left untouched
+	void set(int t, const Eigen::Vector2f &a, const Eigen::Vector2f &b, const Eigen::Vector2f &c);
+
+	// Set the render state of the three vertices of triangle t
+	void set_state(int t, State s);
+
+	// Transform of triangle t
+	Eigen::Map<const Affine> transform(int t) const { return Eigen::Map<const Affine>(transforms.col(t).data()); }
+	Eigen::Map<Affine> transform(int t) { return Eigen::Map<Affine>(transforms.col(t).data()); }
+
+	// Whether triangle t moved since its last reset_transform
+	bool transformed(int t) const;
+
+	// Set the transform of triangle t to the identity, call when its current
+	// positions are sent to the GPU
+	void reset_transform(int t);
+
+	// Insert a triangle in the Normal state at index t. The triangles from t
+	// move up by one, so the drawing order (later is on top) is kept.
+	void insert(int t, const Eigen::Vector2f &a, const Eigen::Vector2f &b, const Eigen::Vector2f &c,
+		const Eigen::Vector3f &color);
+
+	// Remove triangle t, the triangles after it move down by one (O(size - t))
+	void erase(int t);
+
+	// Drop all triangles but keep the allocation
+	void clear() { count = 0; }
+
+	// Set the number of triangles, the streams of new triangles are left
+	// uninitialized for the caller to fill (bulk loads)
+	void resize(int n);
+
+	// Barycenter of triangle t
+	Eigen::Vector2f barycenter(int t) const;
+
+	// Raw stream pointers for the upload and hit-testing code
+	const float *position_data() const { return positions.data(); }
+	const float *color_data() const { return colors.data(); }
+	const float *state_data() const { return states.data(); }
+	const float *transform_data() const { return transforms.data(); }
+
+private:
+	int count;
+
+	void grow(int n);
+
+	// Move the streams of n triangles from index from to index to
+	void move(int from, int to, int n);
+};